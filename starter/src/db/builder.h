@@ -0,0 +1,30 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MINILSM_DB_BUILDER_H_
+#define MINILSM_DB_BUILDER_H_
+
+#include <string>
+
+#include "minilsm/status.h"
+
+namespace minilsm {
+
+struct Options;
+struct FileMetaData;
+
+class Env;
+class Iterator;
+
+// Build a Table file from the contents of *iter.  The generated file
+// will be named according to meta->number.  On success, the rest of
+// *meta will be filled with metadata about the generated table.
+// If no data is present in *iter, meta->file_size will be set to
+// zero, and no Table file will be produced.
+Status BuildTable(const std::string& dbname, Env* env, const Options& options,
+                  Iterator* iter, FileMetaData* meta);
+
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_BUILDER_H_
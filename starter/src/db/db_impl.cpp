@@ -6,14 +6,23 @@
 #include <cstdio>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "db/builder.h"
 #include "db/db_iter.h"
 #include "db/dbformat.h"
+#include "db/filename.h"
+#include "db/log_reader.h"
+#include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/table_cache.h"
+#include "db/version_edit.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "minilsm/cache.h"
 #include "minilsm/db.h"
+#include "minilsm/env.h"
 #include "minilsm/status.h"
 #include "table/merger.h"
 #include "util/coding.h"
@@ -24,91 +33,498 @@ namespace minilsm {
 
 const int kNumNonTableCacheFiles = 10;
 
-// Information for every waiting writer
-struct DBImpl::Writer {
-  explicit Writer(port::Mutex* mu) 
-      : batch(nullptr), sync(false), done(false), cv(mu) {}
-  Status status;
-  WriteBatch* batch;
-  bool sync;
-  bool done;
-  port::CondVar cv;
-};
+// Log records are handed from the reading stage to the applying stage of
+// recovery in chunks of roughly this many bytes, so the hand-off cost is
+// paid per chunk rather than per record.
+static const size_t kReplayChunkBytes = 1 << 20;
+// Number of chunks the reading stage may run ahead of the applying stage.
+static const size_t kMaxReplayChunks = 4;
 
+// Number of threads serving GetAsync, so that lookups that miss the
+// block cache overlap their reads.
+static const int kNumReadThreads = 4;
+
+// Information for every waiting writer
 template <class T, class V>
 static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
   if (static_cast<V>(*ptr) > maxvalue) *ptr = maxvalue;
   if (static_cast<V>(*ptr) < minvalue) *ptr = minvalue;
 }
 
+static int TableCacheSize(const Options& sanitized_options) {
+  // Reserve ten files or so for other uses and give the rest to TableCache.
+  return sanitized_options.max_open_files - kNumNonTableCacheFiles;
+}
+
 Options SanitizeOptions(const std::string& db,
                         const InternalKeyComparator* icmp,
+                        const InternalFilterPolicy* ipolicy,
                         const Options& src) {
   Options result = src;
   result.comparator = icmp;
+  result.filter_policy = (src.filter_policy != nullptr) ? ipolicy : nullptr;
   ClipToRange(&result.max_open_files, 64 + kNumNonTableCacheFiles, 50000);
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
+  if (result.arena_block_size == 0) {
+    result.arena_block_size = result.write_buffer_size / 8;
+  }
+  ClipToRange(&result.arena_block_size, size_t{4 << 10},
+              result.write_buffer_size);
+  ClipToRange(&result.max_write_buffer_number, 2, 64);
+  ClipToRange(&result.compression_parallel_threads, 0, 16);
+  ClipToRange(&result.memtable_bloom_size_ratio, 0.0, 0.25);
+  if (result.inplace_update_num_locks == 0) {
+    result.inplace_update_num_locks = 1;
+  }
+  if (!result.memtable_factory->IsInsertConcurrentlySupported() ||
+      result.inplace_update_support) {
+    result.allow_concurrent_memtable_write = false;
+  }
+  if (result.level0_stop_writes_trigger > 0) {
+    result.level0_stop_writes_trigger =
+        std::max(result.level0_stop_writes_trigger,
+                 result.level0_slowdown_writes_trigger);
+  }
+  if (result.block_cache == nullptr) {
+    result.block_cache = NewLRUCache(8 << 20);
+  }
   return result;
 }
 
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
-    : internal_comparator_(raw_options.comparator),
-      options_(SanitizeOptions(dbname, &internal_comparator_, raw_options)),
+    : env_(raw_options.env),
+      internal_comparator_(raw_options.comparator),
+      internal_filter_policy_(raw_options.filter_policy),
+      options_(SanitizeOptions(dbname, &internal_comparator_,
+                               &internal_filter_policy_, raw_options)),
+      owns_cache_(options_.block_cache != raw_options.block_cache),
       dbname_(dbname),
+      table_cache_(new TableCache(dbname_, options_, TableCacheSize(options_))),
       shutting_down_(false),
       background_work_finished_signal_(&mutex_),
       mem_(nullptr),
-      imm_(nullptr),
       has_imm_(false),
+      logfile_(nullptr),
+      logfile_number_(0),
+      log_(nullptr),
       seed_(0),
-      tmp_batch_(new WriteBatch),
-      versions_(new VersionSet(dbname_, &options_)) {}
+      write_controller_(options_.delayed_write_rate),
+      write_thread_(options_.allow_concurrent_memtable_write,
+                    [this](WriteThread::Writer* w) {
+                      ScheduleDetachedLeader(w);
+                    }),
+      last_allocated_sequence_(0),
+      last_batch_group_size_(0),
+      background_compaction_scheduled_(false),
+      versions_(new VersionSet(dbname_, &options_, table_cache_,
+                               &internal_comparator_)),
+      async_cv_(&async_mutex_),
+      async_shutdown_(false),
+      read_cv_(&read_mutex_),
+      read_shutdown_(false) {}
 
 DBImpl::~DBImpl() {
+  // Finish asynchronous requests first; their writes may still need
+  // background flushes.
+  async_mutex_.Lock();
+  async_shutdown_ = true;
+  async_cv_.SignalAll();
+  async_mutex_.Unlock();
+  if (async_thread_.joinable()) {
+    async_thread_.join();
+  }
+  read_mutex_.Lock();
+  read_shutdown_ = true;
+  read_cv_.SignalAll();
+  read_mutex_.Unlock();
+  for (std::thread& thread : read_threads_) {
+    thread.join();
+  }
+
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.store(true, std::memory_order_release);
+  while (background_compaction_scheduled_) {
+    background_work_finished_signal_.Wait();
+  }
   mutex_.Unlock();
 
   delete versions_;
   if (mem_ != nullptr) mem_->Unref();
-  if (imm_ != nullptr) imm_->Unref();
-  delete tmp_batch_;
+  delete log_;
+  delete logfile_;
+  delete table_cache_;
+
+  if (owns_cache_) {
+    delete options_.block_cache;
+  }
 }
 
 Status DBImpl::NewDB() {
-  Status s;
+  VersionEdit new_db;
+  new_db.SetComparatorName(user_comparator()->Name());
+  new_db.SetLogNumber(0);
+  new_db.SetNextFile(2);
+  new_db.SetLastSequence(0);
+
+  const std::string manifest = DescriptorFileName(dbname_, 1);
+  WritableFile* file;
+  Status s = env_->NewWritableFile(manifest, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  {
+    log::Writer log(file);
+    std::string record;
+    new_db.EncodeTo(&record);
+    s = log.AddRecord(record);
+    if (s.ok()) {
+      s = file->Sync();
+    }
+    if (s.ok()) {
+      s = file->Close();
+    }
+  }
+  delete file;
+  if (s.ok()) {
+    // Make "CURRENT" file that points to the new manifest file.
+    s = SetCurrentFile(env_, dbname_, 1);
+  } else {
+    env_->DeleteFile(manifest);
+  }
   return s;
 }
 
-Status DBImpl::Recover(/* params */) {
+void DBImpl::RemoveObsoleteFiles() {
   mutex_.AssertHeld();
-  Status s;
+
+  if (!bg_error_.ok()) {
+    // After a background error, we don't know whether a new version may
+    // or may not have been committed, so we cannot safely garbage collect.
+    return;
+  }
+
+  // Make a set of all of the live files
+  std::set<uint64_t> live = pending_outputs_;
+  versions_->AddLiveFiles(&live);
+
+  std::vector<std::string> filenames;
+  env_->GetChildren(dbname_, &filenames);  // Ignoring errors on purpose
+  uint64_t number;
+  FileType type;
+  std::vector<std::string> files_to_delete;
+  for (std::string& filename : filenames) {
+    if (ParseFileName(filename, &number, &type)) {
+      bool keep = true;
+      switch (type) {
+        case kLogFile:
+          keep = (number >= versions_->LogNumber());
+          break;
+        case kDescriptorFile:
+          // Keep my manifest file, and any newer incarnations'
+          // (in case there is a race that allows other incarnations)
+          keep = (number >= versions_->ManifestFileNumber());
+          break;
+        case kTableFile:
+          keep = (live.find(number) != live.end());
+          if (!keep) {
+            table_cache_->Evict(number);
+          }
+          break;
+        case kTempFile:
+          // Any temp files that are currently being written to must
+          // be recorded in pending_outputs_, which is inserted into "live"
+          keep = (live.find(number) != live.end());
+          break;
+        case kCurrentFile:
+          keep = true;
+          break;
+      }
+
+      if (!keep) {
+        files_to_delete.push_back(std::move(filename));
+      }
+    }
+  }
+
+  // While deleting all files unblock other threads. All files being deleted
+  // have unique names which will not collide with newly created files and
+  // are therefore safe to delete while allowing other threads to proceed.
+  mutex_.Unlock();
+  for (const std::string& filename : files_to_delete) {
+    env_->DeleteFile(dbname_ + "/" + filename);
+  }
+  mutex_.Lock();
+}
+
+namespace {
+
+// Hand-off between the two stages of log replay.  The reading stage
+// pushes chunks of raw records and blocks while kMaxReplayChunks are
+// pending; the applying stage pops them in order.
+class ReplayQueue {
+ public:
+  ReplayQueue() : cv_(&mu_), closed_(false), cancelled_(false) {}
+
+  ReplayQueue(const ReplayQueue&) = delete;
+  ReplayQueue& operator=(const ReplayQueue&) = delete;
+
+  // Takes the contents of *chunk. Returns false if the consumer has
+  // given up, in which case the producer should stop reading.
+  bool Push(std::vector<std::string>* chunk) {
+    MutexLock l(&mu_);
+    while (chunks_.size() >= kMaxReplayChunks && !cancelled_) {
+      cv_.Wait();
+    }
+    if (cancelled_) return false;
+    chunks_.emplace_back(std::move(*chunk));
+    chunk->clear();
+    cv_.SignalAll();
+    return true;
+  }
+
+  // Returns false once the producer has closed the queue and every
+  // chunk has been handed out.
+  bool Pop(std::vector<std::string>* chunk) {
+    MutexLock l(&mu_);
+    while (chunks_.empty() && !closed_) {
+      cv_.Wait();
+    }
+    if (chunks_.empty()) return false;
+    *chunk = std::move(chunks_.front());
+    chunks_.pop_front();
+    cv_.SignalAll();
+    return true;
+  }
+
+  // Called by the producer after the last Push().
+  void Close() {
+    MutexLock l(&mu_);
+    closed_ = true;
+    cv_.SignalAll();
+  }
+
+  // Called by the consumer to make a blocked Push() return false.
+  void Cancel() {
+    MutexLock l(&mu_);
+    cancelled_ = true;
+    cv_.SignalAll();
+  }
+
+ private:
+  port::Mutex mu_;
+  port::CondVar cv_;
+  std::deque<std::vector<std::string>> chunks_;
+  bool closed_;
+  bool cancelled_;
+};
+
+struct LogReporter : public log::Reader::Reporter {
+  Status* status;  // null if options_.paranoid_checks==false
+  void Corruption(size_t bytes, const Status& s) override {
+    if (this->status != nullptr && this->status->ok()) *this->status = s;
+  }
+};
+
+}  // anonymous namespace
+
+Status DBImpl::Recover(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  // Ignore error from CreateDir since the creation of the DB is
+  // committed only when the descriptor is created, and this directory
+  // may already exist from a previous failed creation attempt.
+  env_->CreateDir(dbname_);
+
+  if (!env_->FileExists(CurrentFileName(dbname_))) {
+    if (options_.create_if_missing) {
+      Status s = NewDB();
+      if (!s.ok()) {
+        return s;
+      }
+    } else {
+      return Status::InvalidArgument(
+          dbname_, "does not exist (create_if_missing is false)");
+    }
+  } else {
+    if (options_.error_if_exists) {
+      return Status::InvalidArgument(dbname_,
+                                     "exists (error_if_exists is true)");
+    }
+  }
+
+  Status s = versions_->Recover();
+  if (!s.ok()) {
+    return s;
+  }
+
+  // Recover from all newer log files than the ones named in the
+  // descriptor (new log files may have been added by the previous
+  // incarnation without registering them in the descriptor).
+  //
+  // Note that DB::Open() creates a new log file after recovery, and
+  // older logs are only deleted once their contents reach a table, so
+  // every log at or past the descriptor's log number must be replayed.
+  const uint64_t min_log = versions_->LogNumber();
+  std::vector<std::string> filenames;
+  s = env_->GetChildren(dbname_, &filenames);
+  if (!s.ok()) {
+    return s;
+  }
+  uint64_t number;
+  FileType type;
+  std::vector<uint64_t> logs;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (ParseFileName(filenames[i], &number, &type)) {
+      // Never hand out the number of an existing file again, or opening
+      // a new log would truncate it.
+      versions_->MarkFileNumberUsed(number);
+      if (type == kLogFile && number >= min_log) {
+        logs.push_back(number);
+      }
+    }
+  }
+
+  // Recover in the order in which the logs were generated
+  std::sort(logs.begin(), logs.end());
   SequenceNumber max_sequence(0);
-  if (versions_->LastSequence() < max_sequence) {
+  if (!logs.empty()) {
+    s = RecoverLogFiles(logs, edit, &max_sequence);
+  }
+  if (s.ok() && versions_->LastSequence() < max_sequence) {
     versions_->SetLastSequence(max_sequence);
   }
+  last_allocated_sequence_ = versions_->LastSequence();
   return s;
 }
 
+Status DBImpl::RecoverLogFiles(const std::vector<uint64_t>& log_numbers,
+                               VersionEdit* edit,
+                               SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  ReplayQueue queue;
+
+  // Reading stage: file I/O and per-record CRC checks. It touches no DB
+  // state, so it runs without mutex_.
+  Status read_status;
+  std::thread reader([&]() {
+    LogReporter reporter;
+    reporter.status = (options_.paranoid_checks ? &read_status : nullptr);
+    std::vector<std::string> chunk;
+    size_t chunk_bytes = 0;
+    bool cancelled = false;
+    for (size_t i = 0; i < log_numbers.size() && !cancelled; i++) {
+      SequentialFile* file;
+      Status s = env_->NewSequentialFile(LogFileName(dbname_, log_numbers[i]),
+                                         &file);
+      if (!s.ok()) {
+        read_status = s;
+        break;
+      }
+      // We intentionally make log::Reader do checksumming even if
+      // paranoid_checks==false so that corruptions cause entire commits
+      // to be skipped instead of propagating bad information (like overly
+      // large sequence numbers).
+      log::Reader log_reader(file, &reporter, true /*checksum*/);
+      std::string scratch;
+      Slice record;
+      while (log_reader.ReadRecord(&record, &scratch) && read_status.ok()) {
+        chunk.emplace_back(record.data(), record.size());
+        chunk_bytes += record.size();
+        if (chunk_bytes >= kReplayChunkBytes) {
+          chunk_bytes = 0;
+          if (!queue.Push(&chunk)) {
+            cancelled = true;
+            break;
+          }
+        }
+      }
+      delete file;
+      if (!read_status.ok()) break;
+    }
+    if (!chunk.empty() && !cancelled) {
+      queue.Push(&chunk);
+    }
+    queue.Close();
+  });
+
+  // Applying stage: decode each record as a WriteBatch and insert it.
+  Status status;
+  LogReporter reporter;
+  reporter.status = (options_.paranoid_checks ? &status : nullptr);
+  WriteBatch batch;
+  MemTable* mem = nullptr;
+  std::vector<std::string> chunk;
+  while (status.ok() && queue.Pop(&chunk)) {
+    for (size_t i = 0; i < chunk.size() && status.ok(); i++) {
+      const std::string& record = chunk[i];
+      if (record.size() < 12) {
+        reporter.Corruption(record.size(),
+                            Status::Corruption("log record too small"));
+        continue;
+      }
+      WriteBatchInternal::SetContents(&batch, record);
+
+      if (mem == nullptr) {
+        mem = new MemTable(internal_comparator_, options_);
+        mem->Ref();
+      }
+      status = WriteBatchInternal::InsertInto(&batch, mem);
+      if (!status.ok() && !options_.paranoid_checks) {
+        // Skip the damaged batch unless asked to be strict.
+        status = Status::OK();
+        continue;
+      }
+      const SequenceNumber last_seq = WriteBatchInternal::Sequence(&batch) +
+                                      WriteBatchInternal::Count(&batch) - 1;
+      if (last_seq > *max_sequence) {
+        *max_sequence = last_seq;
+      }
+
+      if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+        mem->MarkImmutable();
+        status = WriteLevel0Table(std::vector<MemTable*>{mem}, edit);
+        mem->Unref();
+        mem = nullptr;
+      }
+    }
+  }
+  queue.Cancel();
+  reader.join();
+  if (status.ok()) {
+    status = read_status;
+  }
+
+  if (status.ok() && mem != nullptr) {
+    // The replayed tail stays in mem_; its logs are kept until mem_
+    // itself is flushed.
+    assert(mem_ == nullptr);
+    mem_ = mem;
+  } else if (mem != nullptr) {
+    mem->Unref();
+  }
+  return status;
+}
+
 namespace {
-  
+
 struct IterState {
   port::Mutex* const mu;
   Version* const version;
   MemTable* const mem;
-  MemTable* const imm;
-  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
-      : mu(mutex), version(version), mem(mem), imm(imm) {}
+  std::vector<MemTable*> imms;
+  IterState(port::Mutex* mutex, MemTable* mem, Version* version)
+      : mu(mutex), version(version), mem(mem) {}
 };
 
 static void CleanupIteratorState(void* arg1, void* arg2) {
   IterState* state = reinterpret_cast<IterState*>(arg1);
   state->mu->Lock();
   state->mem->Unref();
-  if (state->imm != nullptr) state->imm->Unref();
+  for (MemTable* imm : state->imms) {
+    imm->Unref();
+  }
   state->version->Unref();
   state->mu->Unlock();
   delete state;
@@ -121,24 +537,28 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       uint32_t* seed) {
   mutex_.Lock();
   *latest_snapshot = versions_->LastSequence();
-  // Collect together all needed child iterators
-  std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
   mem_->Ref();
-  if (imm_ != nullptr) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  // extremely smart way to free ownership of version and memtable
+  IterState* cleanup = new IterState(&mutex_, mem_, versions_->current());
+  imm_.Ref(&cleanup->imms);
+  std::vector<Iterator*> table_iters;
+  versions_->current()->AddIterators(options, &table_iters);
+  versions_->current()->Ref();
+  *seed = ++seed_;
+  mutex_.Unlock();
+
+  // Collect together all needed child iterators.  The memtables are
+  // pinned by cleanup, and their iterators may have to sort the entries
+  // first, so they are made without the lock.
+  std::vector<Iterator*> list;
+  list.push_back(cleanup->mem->NewIterator());
+  for (MemTable* imm : cleanup->imms) {
+    list.push_back(imm->NewIterator());
   }
-  // TODO add iterator of file
+  list.insert(list.end(), table_iters.begin(), table_iters.end());
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
-  // extremely smart way to free ownership of version and memtable
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
-
-  *seed = ++seed_;
-  mutex_.Unlock();
   return internal_iter;
 }
 
@@ -150,29 +570,33 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
   SequenceNumber snapshot = versions_->LastSequence();
 
   MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  // TODO mute version for now
+  std::vector<MemTable*> imms;
+  Version* current = versions_->current();
   mem->Ref();
-  if (imm != nullptr) imm->Ref();
+  imm_.Ref(&imms);
+  current->Ref();
 
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
+    // First look in the memtable, then in the immutable memtables from
+    // newest to oldest.
     LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Found
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
-      // Found
-    } else {
-      // Not found
-      s = Status::NotFound(Slice());
+    bool found = mem->Get(lkey, value, &s);
+    for (size_t i = 0; !found && i < imms.size(); i++) {
+      found = imms[i]->Get(lkey, value, &s);
+    }
+    if (!found) {
+      // Then in the tables.
+      s = current->Get(options, lkey, value);
     }
-    // todo: skip sst for now
     mutex_.Lock();
   }
   mem->Unref();
-  if (imm != nullptr) imm->Unref();
+  for (MemTable* imm : imms) {
+    imm->Unref();
+  }
+  current->Unref();
   return s;
 }
 
@@ -193,109 +617,512 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+Status DBImpl::WriteLevel0Table(const std::vector<MemTable*>& mems,
+                                VersionEdit* edit) {
+  mutex_.AssertHeld();
+  FileMetaData meta;
+  meta.number = versions_->NewFileNumber();
+  pending_outputs_.insert(meta.number);
+
+  Status s;
+  {
+    mutex_.Unlock();
+    // The caller keeps mems alive.  Their iterators may have to sort
+    // the entries first, so they are made without the lock as well.
+    Iterator* iter;
+    if (mems.size() == 1) {
+      iter = mems[0]->NewIterator();
+    } else {
+      std::vector<Iterator*> list;
+      for (MemTable* mem : mems) {
+        list.push_back(mem->NewIterator());
+      }
+      iter = NewMergingIterator(&internal_comparator_, &list[0], list.size());
+    }
+    s = BuildTable(dbname_, env_, options_, iter, &meta);
+    delete iter;
+    mutex_.Lock();
+  }
+  pending_outputs_.erase(meta.number);
+
+  // Note that if file_size is zero, the file has been deleted and
+  // should not be added to the manifest.
+  if (s.ok() && meta.file_size > 0) {
+    edit->AddFile(0, meta.number, meta.file_size, meta.smallest,
+                  meta.largest);
+  }
+  return s;
+}
+
+void DBImpl::CompactMemTable() {
+  mutex_.AssertHeld();
+  assert(!imm_.empty());
+
+  // Save the contents of every queued memtable as one new Table.
+  // Memtables frozen while this runs wait for the next round.
+  std::vector<MemTable*> mems;
+  uint64_t log_number;
+  imm_.PickMemTablesToFlush(&mems, &log_number);
+  VersionEdit edit;
+  Status s = WriteLevel0Table(mems, &edit);
+
+  if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
+    s = Status::IOError("Deleting DB during memtable compaction");
+  }
+
+  // Replace immutable memtable with the generated Table
+  if (s.ok()) {
+    edit.SetLogNumber(log_number);  // Earlier logs no longer needed
+    s = versions_->LogAndApply(&edit, &mutex_);
+  }
+
+  if (s.ok()) {
+    // Commit to the new state
+    imm_.RemoveFlushed(mems.size());
+    has_imm_.store(!imm_.empty(), std::memory_order_release);
+    RecalculateWriteStallConditions();
+    RemoveObsoleteFiles();
+  } else {
+    RecordBackgroundError(s);
+  }
+}
+
+void DBImpl::RecalculateWriteStallConditions() {
+  mutex_.AssertHeld();
+  const int imm_count = static_cast<int>(imm_.size());
+  const int l0_count = versions_->NumLevelFiles(0);
+  const int l0_slowdown = options_.level0_slowdown_writes_trigger;
+  const int l0_stop = options_.level0_stop_writes_trigger;
+  const uint64_t pending_bytes = versions_->EstimatedPendingCompactionBytes();
+  const uint64_t soft_limit = options_.soft_pending_compaction_bytes_limit;
+  const uint64_t hard_limit = options_.hard_pending_compaction_bytes_limit;
+
+  // Running out of memtables is already a stop in MakeRoomForWrite.
+  const bool stopped = (l0_stop > 0 && l0_count >= l0_stop) ||
+                       (hard_limit > 0 && pending_bytes >= hard_limit);
+  const bool delayed =
+      stopped ||
+      (options_.max_write_buffer_number > 3 &&
+       imm_count >= options_.max_write_buffer_number - 1) ||
+      (l0_slowdown > 0 && l0_count >= l0_slowdown) ||
+      (soft_limit > 0 && pending_bytes >= soft_limit);
+  write_controller_.SetState(stopped, delayed);
+}
+
+void DBImpl::DelayWrite(uint64_t num_bytes) {
+  mutex_.AssertHeld();
+  const uint64_t start = env_->NowMicros();
+  const uint64_t delay = write_controller_.GetDelay(start, num_bytes);
+  if (delay == 0) {
+    return;
+  }
+  // Sleep in short slices so that a slowdown lifted by a flush frees
+  // the writers promptly.  The writers queued behind this leader are
+  // held back along with it.
+  const int kDelayInterval = 1000;
+  mutex_.Unlock();
+  while (write_controller_.NeedsDelay() && env_->NowMicros() - start < delay) {
+    env_->SleepForMicroseconds(kDelayInterval);
+  }
+  mutex_.Lock();
+}
+
+void DBImpl::RecordBackgroundError(const Status& s) {
+  mutex_.AssertHeld();
+  if (bg_error_.ok()) {
+    bg_error_ = s;
+    background_work_finished_signal_.SignalAll();
+  }
+}
+
+void DBImpl::MaybeScheduleCompaction() {
+  mutex_.AssertHeld();
+  if (background_compaction_scheduled_) {
+    // Already scheduled
+  } else if (shutting_down_.load(std::memory_order_acquire)) {
+    // DB is being deleted; no more background compactions
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (imm_.empty()) {
+    // No work to be done
+  } else {
+    background_compaction_scheduled_ = true;
+    env_->Schedule(&DBImpl::BGWork, this);
+  }
+}
+
+void DBImpl::BGWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundCall();
+}
+
+void DBImpl::BackgroundCall() {
+  MutexLock l(&mutex_);
+  assert(background_compaction_scheduled_);
+  if (shutting_down_.load(std::memory_order_acquire)) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else {
+    BackgroundCompaction();
+  }
+
+  background_compaction_scheduled_ = false;
+
+  // The previous flush may have produced work for another round, so
+  // reschedule another one if needed.
+  MaybeScheduleCompaction();
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::BackgroundCompaction() {
+  mutex_.AssertHeld();
+
+  if (!imm_.empty()) {
+    CompactMemTable();
+  }
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
-  Writer w(&mutex_);
-  w.batch = updates;
-  w.sync = options.sync;
-  w.done = false;
+  WriteThread::Writer w(updates, options.sync);
+  write_thread_.JoinBatchGroup(&w);
+  return RunWriter(&w);
+}
 
-  MutexLock l(&mutex_);  // auto unlock when destruction
-  writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
-    w.cv.Wait();
+void DBImpl::WriteAsync(const WriteOptions& options, WriteBatch* updates,
+                        WriteCallback callback) {
+  assert(updates != nullptr);
+  WriteThread::Writer* w = new WriteThread::Writer(updates, options.sync);
+  w->detached = true;
+  w->callback = std::move(callback);
+  if (write_thread_.JoinBatchGroupDetached(w)) {
+    // Nobody was writing.  Leading the group would log and apply it on
+    // this thread, so hand it off like any other detached leader.
+    ScheduleDetachedLeader(w);
   }
-  // w might have been done by previous writer
-  if (w.done) {
-    return w.status;
+}
+
+void DBImpl::ScheduleDetachedLeader(WriteThread::Writer* w) {
+  ScheduleAsync([this, w]() {
+    Status s = RunWriter(w);
+    WriteCallback done = std::move(w->callback);
+    delete w;
+    done(s);
+  });
+}
+
+void DBImpl::GetAsync(const ReadOptions& options, const Slice& key,
+                      GetCallback callback) {
+  MutexLock l(&read_mutex_);
+  assert(!read_shutdown_);
+  if (read_threads_.empty()) {
+    for (int i = 0; i < kNumReadThreads; i++) {
+      read_threads_.emplace_back(&DBImpl::ReadThreadMain, this);
+    }
   }
+  read_queue_.push_back([this, options, key = key.ToString(),
+                         callback = std::move(callback)]() {
+    std::string value;
+    Status s = Get(options, key, &value);
+    callback(s, value);
+  });
+  read_cv_.Signal();
+}
 
-  // Write to memtable
-  Status status;
-  uint64_t last_sequence = versions_->LastSequence();
-  Writer* last_writer = &w;
-  if (status.ok() && updates != nullptr) { // nullptr batch is for compactions
-    WriteBatch* write_batch = BuildBatchGroup(&last_writer);
-    // updates must be the first in deque
-    // increasing
-    WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);  
-    // number of records
-    last_sequence += WriteBatchInternal::Count(write_batch);  
-
-    // apply to memtable. We can release the lock
-    // during this phase since &w is currently responsible for protecting
-    // against concurrent writes into mem_.
-    {
-      mutex_.Unlock();
-      status = WriteBatchInternal::InsertInto(write_batch, mem_);
-      mutex_.Lock();
+void DBImpl::ScheduleAsync(std::function<void()> task) {
+  MutexLock l(&async_mutex_);
+  ScheduleAsyncLocked(std::move(task));
+}
+
+void DBImpl::ScheduleAsyncLocked(std::function<void()> task) {
+  async_mutex_.AssertHeld();
+  // While draining at shutdown, a queued task may still hand the log to
+  // a detached writer.
+  assert(!async_shutdown_ ||
+         std::this_thread::get_id() == async_thread_.get_id());
+  if (!async_thread_.joinable()) {
+    async_thread_ = std::thread(&DBImpl::AsyncThreadMain, this);
+  }
+  async_queue_.push_back(std::move(task));
+  async_cv_.Signal();
+}
+
+void DBImpl::SetActiveMemTable() {
+  mutex_.AssertHeld();
+  if (options_.write_buffer_manager != nullptr) {
+    options_.write_buffer_manager->SetActive(
+        mem_, [this]() { ScheduleWriteBufferFlush(); });
+  }
+}
+
+void DBImpl::ScheduleWriteBufferFlush() {
+  MutexLock l(&async_mutex_);
+  if (async_shutdown_) {
+    // Closing the DB frees the memtable soon enough.
+    return;
+  }
+  // Queue a detached writer without a batch: as a leader it forces a
+  // memtable switch, like a full memtable, and it never blocks a thread
+  // while it waits for the log.  If mem has been switched out by the
+  // time it runs, the fresh memtable is switched out too, which only
+  // costs a small flush.
+  WriteThread::Writer* w = new WriteThread::Writer(nullptr, false);
+  w->detached = true;
+  w->callback = [](const Status&) {};
+  if (write_thread_.JoinBatchGroupDetached(w)) {
+    // Not inline: the caller may hold mutex_ and the manager's lock.
+    ScheduleAsyncLocked([this, w]() {
+      RunWriter(w);
+      delete w;
+    });
+  }
+}
+
+void DBImpl::AsyncThreadMain() {
+  async_mutex_.Lock();
+  while (true) {
+    while (async_queue_.empty() && !async_shutdown_) {
+      async_cv_.Wait();
+    }
+    if (async_queue_.empty()) {
+      break;
     }
-    if (write_batch == tmp_batch_) tmp_batch_->Clear();
-    versions_->SetLastSequence(last_sequence);  // last operation number
+    std::function<void()> task = std::move(async_queue_.front());
+    async_queue_.pop_front();
+    async_mutex_.Unlock();
+    task();
+    async_mutex_.Lock();
   }
+  async_mutex_.Unlock();
+}
+
+void DBImpl::ReadThreadMain() {
+  read_mutex_.Lock();
   while (true) {
-    Writer* ready = writers_.front();
-    writers_.pop_front();
-    if (ready != &w) {
-      ready->status = status;
-      ready->done = true;
-      ready->cv.Signal();
-    } 
-    if (ready == last_writer) break;
-  }
-  // Notify new head of write queue
-  if (!writers_.empty()) {
-    writers_.front()->cv.Signal();
+    while (read_queue_.empty() && !read_shutdown_) {
+      read_cv_.Wait();
+    }
+    if (read_queue_.empty()) {
+      break;
+    }
+    std::function<void()> task = std::move(read_queue_.front());
+    read_queue_.pop_front();
+    read_mutex_.Unlock();
+    task();
+    read_mutex_.Lock();
   }
-  return status;
+  read_mutex_.Unlock();
 }
 
-// REQUIRE: writer list must be non-empty
-// REQUIRE: first writer must have a non-null batch
-WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
+Status DBImpl::RunWriter(WriteThread::Writer* w) {
+  WriteBatch* updates = w->batch;
+
+  // The write path is a two-stage pipeline.  A group leader takes the
+  // writers queued behind it through the log; the group then waits in
+  // the memtable queue and is applied there, in log order, while the
+  // next group is already being logged.  Followers never touch mutex_.
+
+  if (w->state == WriteThread::STATE_GROUP_LEADER) {
+    Status status;
+    {
+      MutexLock l(&mutex_);
+      // May temporarily unlock and wait.
+      if (updates != nullptr) {
+        DelayWrite(last_batch_group_size_);
+      }
+      status = MakeRoomForWrite(updates == nullptr);
+    }
+
+    // Until the hand-off below, this thread alone uses log_, log_parts_
+    // and last_allocated_sequence_.
+    WriteThread::WriteGroup group;
+    last_batch_group_size_ =
+        write_thread_.EnterAsBatchGroupLeader(w, &group);
+    if (status.ok() && updates != nullptr) { // nullptr batch is for compactions
+      bool need_sync = false;
+      BuildBatchGroup(group, &need_sync);
+
+      // Writers queued up meanwhile form the next group, and that group
+      // shares a single fsync as well (group commit).
+      status = log_->AddRecord(log_parts_.data(), log_parts_.size());
+      if (status.ok() && need_sync) {
+        status = logfile_->Sync();
+        if (!status.ok()) {
+          // The state of the log file is indeterminate: the log record we
+          // just added may or may not show up when the DB is re-opened.
+          // So we force the DB into a mode where all future writes fail.
+          MutexLock l(&mutex_);
+          RecordBackgroundError(status);
+        }
+      }
+    }
+    write_thread_.ExitAsBatchGroupLeader(group, status);
+    if (w->state == WriteThread::STATE_GROUP_LEADER) {
+      // The group did not reach the memtable stage.
+      return status;
+    }
+  }
+
+  // Must outlive the parallel writers this thread may launch.
+  WriteThread::WriteGroup memtable_group;
+  if (w->state == WriteThread::STATE_MEMTABLE_WRITER_LEADER) {
+    write_thread_.EnterAsMemTableWriter(w, &memtable_group);
+    if (memtable_group.size > 1 && options_.allow_concurrent_memtable_write) {
+      write_thread_.LaunchParallelMemTableWriters(&memtable_group);
+    } else {
+      MemTable* mem = mem_;
+      for (WriteThread::Writer* writer = memtable_group.leader;;
+           writer = writer->link_newer) {
+        memtable_group.status =
+            WriteBatchInternal::InsertInto(writer->batch, mem);
+        if (!memtable_group.status.ok() ||
+            writer == memtable_group.last_writer) {
+          break;
+        }
+      }
+      versions_->SetLastSequence(memtable_group.last_sequence);
+      write_thread_.ExitAsMemTableWriter(w, memtable_group);
+    }
+  }
+
+  if (w->state == WriteThread::STATE_PARALLEL_MEMTABLE_WRITER) {
+    w->status = WriteBatchInternal::InsertInto(w->batch, mem_, true);
+    WriteThread::WriteGroup* group = w->write_group;
+    if (w == group->leader) {
+      // Detached writers have no thread of their own to insert with.
+      for (WriteThread::Writer* f = w; w->status.ok() &&
+                                       f != group->last_writer;) {
+        f = f->link_newer;
+        if (f->detached) {
+          w->status = WriteBatchInternal::InsertInto(f->batch, mem_, true);
+        }
+      }
+    }
+    if (write_thread_.CompleteParallelMemTableWriter(w)) {
+      // Groups leave the memtable stage in log order, so sequence
+      // numbers become visible in order too.
+      versions_->SetLastSequence(w->write_group->last_sequence);
+      write_thread_.ExitAsMemTableWriter(w, *w->write_group);
+    }
+  }
+
+  assert(w->state == WriteThread::STATE_COMPLETED);
+  return w->status;
+}
+
+// REQUIRES: mutex_ is held
+// REQUIRES: this thread is the current group leader
+Status DBImpl::MakeRoomForWrite(bool force) {
   mutex_.AssertHeld();
-  assert(!writers_.empty());
-  // merge the current batch into a larger batch
-  Writer* first = writers_.front();  
-  WriteBatch* result = first->batch;
-  assert(result != nullptr);
-
-  size_t size = WriteBatchInternal::ByteSize(result);
-  // Allow the group to grow up to a maximum size, but if the 
-  // original write is small, limit the growth so we do not slow
-  // down the small write too much.
-  size_t max_size = 1 << 20;  // 1MB
-  if (size <= (128 << 10)) {  // 128KB
-    max_size = size += (128 << 10);
-  }
-
-  *last_writer = first;  // the last writer in the batch group
-  // advance past "first"
-  std::deque<Writer*>::iterator iter = writers_.begin() + 1;  
-
-  for (; iter != writers_.end(); ++iter) {
-    Writer* w = *iter;
-    if (w->sync && !first->sync) {
-      // Do not include a sync write into a batch handled by a non-sync write.
+  Status s;
+  if (options_.write_buffer_manager != nullptr) {
+    // Memtables shared out by the manager may be over budget, whether or
+    // not mem_ is the one to flush.
+    options_.write_buffer_manager->MaybeFlush();
+  }
+  while (true) {
+    if (!bg_error_.ok()) {
+      // Yield previous error
+      s = bg_error_;
       break;
-    }
-    if (w->batch != nullptr) {
-      size += WriteBatchInternal::ByteSize(w->batch);
-      if (size > max_size) {
-        // Do not make batch too big
+    } else if (write_controller_.IsStopped() &&
+               background_compaction_scheduled_) {
+      // A hard limit is reached; wait for background work to get back
+      // under it.  Only background work can lift a stop, so with none
+      // in flight the write is merely delayed rather than parked for
+      // good.
+      background_work_finished_signal_.Wait();
+    } else if (!force &&
+               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
+      // There is room in current memtable
+      break;
+    } else if (imm_.size() + 1 >= options_.max_write_buffer_number) {
+      // We have filled up the current memtable, but as many memtables
+      // as allowed are still waiting to be flushed, so we wait.
+      background_work_finished_signal_.Wait();
+    } else {
+      // Attempt to switch to a new memtable and trigger flush of old.
+      // Earlier groups may still be applying to mem_, which must not be
+      // frozen under them.
+      write_thread_.WaitForMemTableWriters();
+      uint64_t new_log_number = versions_->NewFileNumber();
+      WritableFile* lfile = nullptr;
+      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
+      if (!s.ok()) {
         break;
       }
-      // Append to *result
-      if (result == first->batch) {
-        // Switch to temporary batch instead of disturbing caller's batch
-        result = tmp_batch_;
-        assert(WriteBatchInternal::Count(result) == 0);
-        WriteBatchInternal::Append(result, first->batch);
+
+      delete log_;
+
+      s = logfile_->Close();
+      if (!s.ok()) {
+        // We may have lost some data written to the previous log file.
+        // Switch to the new log file anyway, but record as a background
+        // error so we do not attempt any more writes.
+        //
+        // We could perhaps attempt to save the memtable corresponding
+        // to log file and suppress the error if that works, but that
+        // would add more complexity in a critical code path.
+        RecordBackgroundError(s);
       }
-      WriteBatchInternal::Append(result, w->batch);
+      delete logfile_;
+
+      logfile_ = lfile;
+      logfile_number_ = new_log_number;
+      log_ = new log::Writer(lfile);
+      imm_.Add(mem_, new_log_number);
+      has_imm_.store(true, std::memory_order_release);
+      mem_ = new MemTable(internal_comparator_, options_);
+      mem_->Ref();
+      SetActiveMemTable();
+      RecalculateWriteStallConditions();
+      force = false;  // Do not force another compaction if have room
+      MaybeScheduleCompaction();
     }
-    *last_writer = w;
   }
-  return result;
+  return s;
+}
+
+// Assign each batch of the group its sequence numbers and merge the
+// batches into the single record that is logged for the group.
+// REQUIRES: this thread is the current group leader
+// REQUIRES: first writer must have a non-null batch
+void DBImpl::BuildBatchGroup(WriteThread::WriteGroup& group,
+                             bool* need_sync) {
+  WriteThread::Writer* first = group.leader;
+  assert(first->batch != nullptr);
+
+  // Sequence numbers are handed out here but only become visible once
+  // the group has been applied to the memtable.
+  const SequenceNumber first_sequence = last_allocated_sequence_ + 1;
+  SequenceNumber seq = first_sequence;
+  *need_sync = false;
+  log_parts_.clear();
+  if (first == group.last_writer) {
+    // A lone writer is logged straight from its own batch.
+    first->sequence = seq;
+    WriteBatchInternal::SetSequence(first->batch, seq);
+    seq += WriteBatchInternal::Count(first->batch);
+    log_parts_.push_back(WriteBatchInternal::Contents(first->batch));
+    *need_sync = first->sync;
+  } else {
+    // Otherwise the records are written out where they are, behind a
+    // header covering the whole group, rather than being copied into
+    // one batch first.
+    log_parts_.push_back(Slice(group_header_, sizeof(group_header_)));
+    for (WriteThread::Writer* w = first;; w = w->link_newer) {
+      w->sequence = seq;
+      WriteBatchInternal::SetSequence(w->batch, seq);
+      seq += WriteBatchInternal::Count(w->batch);
+      log_parts_.push_back(WriteBatchInternal::Records(w->batch));
+      // A sync writer upgrades the whole group: its fsync makes the
+      // non-sync members durable for free.
+      *need_sync = *need_sync || w->sync;
+      if (w == group.last_writer) break;
+    }
+    WriteBatchInternal::EncodeHeader(group_header_, first_sequence,
+                                     static_cast<int>(seq - first_sequence));
+  }
+  last_allocated_sequence_ = seq - 1;
 }
 
 // Default implementations of convenience methods that subclasses of DB
@@ -312,19 +1139,58 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+void DB::WriteAsync(const WriteOptions& options, WriteBatch* updates,
+                    WriteCallback callback) {
+  callback(Write(options, updates));
+}
+
+void DB::GetAsync(const ReadOptions& options, const Slice& key,
+                  GetCallback callback) {
+  std::string value;
+  Status s = Get(options, key, &value);
+  callback(s, value);
+}
+
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
   *dbptr = nullptr;
   DBImpl* impl = new DBImpl(options, dbname);
   impl->mutex_.Lock();
-  Status s = impl->Recover();
-  if (s.ok() && impl->mem_ == nullptr) {
-    impl->mem_ = new MemTable(impl->internal_comparator_);
-    impl->mem_->Ref();
+  VersionEdit edit;
+  Status s = impl->Recover(&edit);
+  if (s.ok()) {
+    // Create new log and, unless recovery left one behind, a
+    // corresponding memtable.
+    uint64_t new_log_number = impl->versions_->NewFileNumber();
+    WritableFile* lfile;
+    s = options.env->NewWritableFile(LogFileName(dbname, new_log_number),
+                                     &lfile);
+    if (s.ok()) {
+      impl->logfile_ = lfile;
+      impl->logfile_number_ = new_log_number;
+      impl->log_ = new log::Writer(lfile);
+      if (impl->mem_ == nullptr) {
+        // Everything replayed (if anything) is already in tables.
+        edit.SetLogNumber(new_log_number);
+        impl->mem_ = new MemTable(impl->internal_comparator_, impl->options_);
+        impl->mem_->Ref();
+      }
+      impl->SetActiveMemTable();
+    }
+  }
+  if (s.ok()) {
+    s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
+  }
+  if (s.ok()) {
+    impl->RemoveObsoleteFiles();
+    impl->RecalculateWriteStallConditions();
+    impl->MaybeScheduleCompaction();
   }
   impl->mutex_.Unlock();
   if (s.ok()) {
     assert(impl->mem_ != nullptr);
     *dbptr = impl;
+  } else {
+    delete impl;
   }
   return s;
 }
@@ -2,10 +2,18 @@
 #define MINILSM_DB_DB_IMPL_H_
 #include <atomic>
 #include <deque>
+#include <functional>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "db/dbformat.h"
+#include "db/log_writer.h"
+#include "db/memtable_list.h"
+#include "db/write_batch_internal.h"
+#include "db/write_controller.h"
+#include "db/write_thread.h"
 #include "minilsm/db.h"
 #include "port/port.h"
 
@@ -13,6 +21,8 @@
 namespace minilsm {
 
 class MemTable;
+class TableCache;
+class VersionEdit;
 class VersionSet;
 
 class DBImpl : public DB {
@@ -30,11 +40,13 @@ public:
   Status Get(const ReadOptions& options, const Slice& key,
              std::string* value) override;
   Iterator* NewIterator(const ReadOptions&) override;
-  
+  void WriteAsync(const WriteOptions& options, WriteBatch* updates,
+                  WriteCallback callback) override;
+  void GetAsync(const ReadOptions& options, const Slice& key,
+                GetCallback callback) override;
 
 private:
   friend class DB;
-  struct Writer;
 
   // Return an internal iterator over the current state of the database.
   // The keys of this iterator are internal keys (see format.h).
@@ -46,37 +58,149 @@ private:
   // Recover the descriptor from persistent storage.  May do a significant
   // amount of work to recover recently logged updates.  Any changes to
   // be made to the descriptor are added to *edit.
-  Status Recover();
-
-  WriteBatch* BuildBatchGroup(Writer** last_writer);
+  Status Recover(VersionEdit* edit);
+
+  // Replay the given log files, oldest first, into a fresh memtable.
+  // Reading and checksumming run on a separate thread from decoding
+  // and inserting, so the two stages overlap.  Memtables that fill up
+  // during replay are written to level-0 tables recorded in *edit.
+  Status RecoverLogFiles(const std::vector<uint64_t>& log_numbers,
+                         VersionEdit* edit, SequenceNumber* max_sequence);
+
+  // Delete any unneeded files and stale in-memory entries.
+  void RemoveObsoleteFiles();
+
+  // Compact the in-memory write buffer to disk.  Switches to a new
+  // log-file/memtable and writes a new descriptor iff successful.
+  // Errors are recorded in bg_error_.
+  void CompactMemTable();
+
+  // Write the contents of *mems, merged, into one level-0 table.
+  Status WriteLevel0Table(const std::vector<MemTable*>& mems,
+                          VersionEdit* edit);
+
+  // Switch to a fresh memtable once mem_ exceeds write_buffer_size,
+  // waiting for a flush if max_write_buffer_number memtables exist.
+  // force - compact even if there is room?
+  Status MakeRoomForWrite(bool force);
+
+  // Recompute write_controller_ from the memtables waiting to be
+  // flushed and the shape of the current version.
+  void RecalculateWriteStallConditions();
+
+  // Hold the group leader back as write_controller_ asks for a write
+  // of num_bytes.  May temporarily unlock mutex_.
+  void DelayWrite(uint64_t num_bytes);
+
+  // Lay out the batches of a group as a single batch to log.  The batch
+  // is gathered into log_parts_ from the members' own buffers: a header
+  // in group_header_ followed by the records of each batch.
+  // *need_sync is set if any writer in the group asked for sync, so the
+  // leader issues one fsync on behalf of all of them.
+  void BuildBatchGroup(WriteThread::WriteGroup& group, bool* need_sync);
+
+  // Take w, which JoinBatchGroup has given a role, through the rest of
+  // the write pipeline and return its status.
+  Status RunWriter(WriteThread::Writer* w);
+
+  // Run a detached writer that was handed the log, on the async thread.
+  void ScheduleDetachedLeader(WriteThread::Writer* w);
+
+  // Run task on the async thread, starting it if needed.
+  void ScheduleAsync(std::function<void()> task);
+  // Same, with async_mutex_ held and the thread not shut down.
+  void ScheduleAsyncLocked(std::function<void()> task);
+
+  // Hand the write buffer manager, if any, a way to flush mem_ when the
+  // memtables it shares out run over budget.
+  void SetActiveMemTable();
+  // Queue a forced switch and flush of mem_ behind the writers already
+  // waiting, unless the DB is closing.
+  void ScheduleWriteBufferFlush();
+  void AsyncThreadMain();
+  void ReadThreadMain();
+
+  void RecordBackgroundError(const Status& s);
+
+  void MaybeScheduleCompaction();
+  static void BGWork(void* db);
+  void BackgroundCall();
+  void BackgroundCompaction();
 
   const Comparator* user_comparator() const {
     return internal_comparator_.user_comparator();
   }
 
+  // Constant after construction
+  Env* const env_;
   // For comparing internal keys, but compare userkey with a user comparator
   const InternalKeyComparator internal_comparator_;
-  const Options options_;
+  const InternalFilterPolicy internal_filter_policy_;
+  const Options options_;  // options_.comparator == &internal_comparator_
+  const bool owns_cache_;
   const std::string dbname_;
 
+  // table_cache_ provides its own synchronization
+  TableCache* const table_cache_;
+
   // State below is protected by mutex_
   port::Mutex mutex_;
   std::atomic<bool> shutting_down_;
   port::CondVar background_work_finished_signal_;
   MemTable* mem_;
-  MemTable* imm_;
-  std::atomic<bool> has_imm_;  // So bg thread can detect non-null imm_
+  MemTableList imm_;  // Memtables being flushed
+  std::atomic<bool> has_imm_;  // So bg thread can detect non-empty imm_
+  WritableFile* logfile_;
+  uint64_t logfile_number_;
+  log::Writer* log_;
   uint32_t seed_;  // For sampling.
-
-  // Queue of writers.
-  std::deque<Writer*> writers_;
-  WriteBatch* tmp_batch_;
+  WriteController write_controller_;
+
+  // Queue of writers.  The fields below up to last_allocated_sequence_
+  // belong to the current group leader rather than to mutex_.
+  WriteThread write_thread_;
+  char group_header_[WriteBatchInternal::kHeaderSize];
+  std::vector<Slice> log_parts_;
+  // Last sequence number handed to a logged group.  Runs ahead of
+  // versions_->LastSequence() while groups wait for the memtable.
+  SequenceNumber last_allocated_sequence_;
+  // Byte size of the previous group, charged to the next group's
+  // leader while writes are delayed.
+  uint64_t last_batch_group_size_;
+
+  // Set of table files to protect from deletion because they are
+  // part of ongoing flushes.
+  std::set<uint64_t> pending_outputs_;
+
+  // Has a background flush been scheduled or is running?
+  bool background_compaction_scheduled_;
 
   VersionSet* const versions_;
+
+  // Have we encountered a background error in paranoid mode?
+  Status bg_error_;
+
+  // Thread that leads writes for detached writers.  It is started on
+  // first use and drains its queue before the DB goes away.
+  port::Mutex async_mutex_;
+  port::CondVar async_cv_;
+  std::deque<std::function<void()>> async_queue_;  // Guarded by async_mutex_
+  bool async_shutdown_;                            // Guarded by async_mutex_
+  std::thread async_thread_;
+
+  // Threads that serve GetAsync, apart from the async thread so that
+  // lookups neither wait on a write leader that is being delayed nor
+  // on each other.  Started and drained like the async thread.
+  port::Mutex read_mutex_;
+  port::CondVar read_cv_;
+  std::deque<std::function<void()>> read_queue_;  // Guarded by read_mutex_
+  bool read_shutdown_;                            // Guarded by read_mutex_
+  std::vector<std::thread> read_threads_;         // Guarded by read_mutex_
 };
 
 Options SanitizeOptions(const std::string& db,
                         const InternalKeyComparator* icmp,
+                        const InternalFilterPolicy* ipolicy,
                         const Options& src);
 }
 #endif  // MINILSM_DB_MEMTABLE_H_
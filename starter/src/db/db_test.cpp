@@ -0,0 +1,1127 @@
+#include "minilsm/db.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "minilsm/env.h"
+#include "minilsm/filter_policy.h"
+#include "minilsm/memtablerep.h"
+#include "minilsm/slice_transform.h"
+#include "minilsm/write_batch.h"
+#include "minilsm/write_buffer_manager.h"
+#include "util/random.h"
+
+#include <gtest/gtest.h>
+
+namespace minilsm {
+
+// Holds back background work until Release(), so tests can look at
+// memtables that are waiting to be flushed.
+class HoldBackgroundEnv : public EnvWrapper {
+ public:
+  explicit HoldBackgroundEnv(Env* target) : EnvWrapper(target) {}
+
+  void Schedule(void (*function)(void*), void* arg) override {
+    std::lock_guard<std::mutex> l(mu_);
+    if (held_) {
+      pending_.emplace_back(function, arg);
+    } else {
+      target()->Schedule(function, arg);
+    }
+  }
+
+  void Release() {
+    std::lock_guard<std::mutex> l(mu_);
+    held_ = false;
+    for (const auto& work : pending_) {
+      target()->Schedule(work.first, work.second);
+    }
+    pending_.clear();
+  }
+
+ private:
+  std::mutex mu_;
+  bool held_ = true;
+  std::vector<std::pair<void (*)(void*), void*>> pending_;
+};
+
+// Counts the reads made through the random access files it opens.
+class CountReadsEnv : public EnvWrapper {
+ public:
+  explicit CountReadsEnv(Env* target) : EnvWrapper(target) {}
+
+  Status NewRandomAccessFile(const std::string& fname,
+                             RandomAccessFile** result) override {
+    Status s = target()->NewRandomAccessFile(fname, result);
+    if (s.ok()) {
+      *result = new CountingFile(*result, &reads_);
+    }
+    return s;
+  }
+
+  int reads() const { return reads_.load(); }
+  void ResetReads() { reads_.store(0); }
+
+ private:
+  class CountingFile : public RandomAccessFile {
+   public:
+    CountingFile(RandomAccessFile* target, std::atomic<int>* reads)
+        : target_(target), reads_(reads) {}
+    ~CountingFile() override { delete target_; }
+
+    Status Read(uint64_t offset, size_t n, Slice* result,
+                char* scratch) const override {
+      reads_->fetch_add(1);
+      return target_->Read(offset, n, result, scratch);
+    }
+
+   private:
+    RandomAccessFile* const target_;
+    std::atomic<int>* const reads_;
+  };
+
+  std::atomic<int> reads_{0};
+};
+
+// Fails the appends to log files while SetFail(true) is in effect.
+class FailLogAppendsEnv : public EnvWrapper {
+ public:
+  explicit FailLogAppendsEnv(Env* target) : EnvWrapper(target) {}
+
+  Status NewWritableFile(const std::string& fname,
+                         WritableFile** result) override {
+    Status s = target()->NewWritableFile(fname, result);
+    if (s.ok() && fname.size() > 4 &&
+        fname.compare(fname.size() - 4, 4, ".log") == 0) {
+      *result = new FailingFile(*result, &fail_);
+    }
+    return s;
+  }
+
+  void SetFail(bool fail) { fail_.store(fail); }
+
+ private:
+  class FailingFile : public WritableFile {
+   public:
+    FailingFile(WritableFile* target, std::atomic<bool>* fail)
+        : target_(target), fail_(fail) {}
+    ~FailingFile() override { delete target_; }
+
+    Status Append(const Slice& data) override {
+      return fail_->load() ? Fail() : target_->Append(data);
+    }
+    Status Appendv(const Slice* data, size_t n) override {
+      return fail_->load() ? Fail() : target_->Appendv(data, n);
+    }
+    Status Close() override { return target_->Close(); }
+    Status Flush() override { return target_->Flush(); }
+    Status Sync() override { return target_->Sync(); }
+
+   private:
+    // Take a moment, as a real write would, so that writers queue up
+    // behind the failing group.
+    static Status Fail() {
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+      return Status::IOError("injected log append error");
+    }
+
+    WritableFile* const target_;
+    std::atomic<bool>* const fail_;
+  };
+
+  std::atomic<bool> fail_{false};
+};
+
+// Holds syncs of log files in BlockSyncs() until Release().
+class BlockLogSyncEnv : public EnvWrapper {
+ public:
+  explicit BlockLogSyncEnv(Env* target) : EnvWrapper(target) {}
+
+  Status NewWritableFile(const std::string& fname,
+                         WritableFile** result) override {
+    Status s = target()->NewWritableFile(fname, result);
+    if (s.ok() && fname.size() > 4 &&
+        fname.compare(fname.size() - 4, 4, ".log") == 0) {
+      *result = new BlockingFile(*result, this);
+    }
+    return s;
+  }
+
+  // Wait until a sync is being held.
+  void WaitForBlockedSync() {
+    std::unique_lock<std::mutex> l(mu_);
+    cv_.wait(l, [this] { return blocked_ > 0; });
+  }
+
+  void Release() {
+    std::lock_guard<std::mutex> l(mu_);
+    released_ = true;
+    cv_.notify_all();
+  }
+
+ private:
+  class BlockingFile : public WritableFile {
+   public:
+    BlockingFile(WritableFile* target, BlockLogSyncEnv* env)
+        : target_(target), env_(env) {}
+    ~BlockingFile() override { delete target_; }
+
+    Status Append(const Slice& data) override {
+      return target_->Append(data);
+    }
+    Status Appendv(const Slice* data, size_t n) override {
+      return target_->Appendv(data, n);
+    }
+    Status Close() override { return target_->Close(); }
+    Status Flush() override { return target_->Flush(); }
+    Status Sync() override {
+      {
+        std::unique_lock<std::mutex> l(env_->mu_);
+        env_->blocked_++;
+        env_->cv_.notify_all();
+        env_->cv_.wait(l, [this] { return env_->released_; });
+      }
+      return target_->Sync();
+    }
+
+   private:
+    WritableFile* const target_;
+    BlockLogSyncEnv* const env_;
+  };
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  int blocked_ = 0;
+  bool released_ = false;
+};
+
+class DBTest : public testing::Test {
+ public:
+  DBTest() : env_(Env::Default()), db_(nullptr) {
+    dbname_ = testing::TempDir() + "minilsm_db_test";
+    DestroyFiles();
+    Reopen();
+  }
+  ~DBTest() override {
+    delete db_;
+    DestroyFiles();
+  }
+
+  void Reopen(Options* options = nullptr) {
+    delete db_;
+    db_ = nullptr;
+    Options opts;
+    if (options != nullptr) {
+      opts = *options;
+    }
+    opts.create_if_missing = true;
+    ASSERT_TRUE(DB::Open(opts, dbname_, &db_).ok());
+  }
+
+  Status Put(const std::string& k, const std::string& v, bool sync = false) {
+    WriteOptions options;
+    options.sync = sync;
+    return db_->Put(options, k, v);
+  }
+
+  int CountFiles(const std::string& suffix) {
+    std::vector<std::string> children;
+    env_->GetChildren(dbname_, &children);
+    int count = 0;
+    for (const std::string& child : children) {
+      if (child.size() >= suffix.size() &&
+          child.compare(child.size() - suffix.size(), suffix.size(),
+                        suffix) == 0) {
+        count++;
+      }
+    }
+    return count;
+  }
+
+  std::string Get(const std::string& k) {
+    std::string result;
+    Status s = db_->Get(ReadOptions(), k, &result);
+    if (s.IsNotFound()) {
+      result = "NOT_FOUND";
+    } else if (!s.ok()) {
+      result = s.ToString();
+    }
+    return result;
+  }
+
+  // Checks that Gets for keys that are in no table rarely read a data
+  // block when tables carry the filters of policy.
+  void CheckFilterSkipsDataBlocks(const FilterPolicy* policy) {
+    CountReadsEnv env(Env::Default());
+    Options options;
+    options.env = &env;
+    options.filter_policy = policy;
+    options.write_buffer_size = 64 << 10;
+    Reopen(&options);
+    for (int i = 0; i < 5000; i++) {
+      ASSERT_TRUE(
+          Put("key" + std::to_string(2 * i), std::string(100, 'v')).ok());
+    }
+    // Everything is in tables after a reopen.
+    Reopen(&options);
+    ASSERT_GT(CountFiles(".ldb"), 1);
+    // Opens the tables, which reads their filters.
+    for (int i = 0; i < 5000; i++) {
+      ASSERT_EQ(std::string(100, 'v'), Get("key" + std::to_string(2 * i)));
+    }
+
+    env.ResetReads();
+    for (int i = 0; i < 5000; i++) {
+      ASSERT_EQ("NOT_FOUND", Get("key" + std::to_string(2 * i + 1)));
+    }
+    // Without the filters, every Get would read a data block.
+    ASSERT_LT(env.reads(), 5000 / 20);
+    Reopen();
+  }
+
+  Env* env_;
+  std::string dbname_;
+  DB* db_;
+
+ private:
+  void DestroyFiles() {
+    std::vector<std::string> children;
+    if (env_->GetChildren(dbname_, &children).ok()) {
+      for (const std::string& child : children) {
+        env_->DeleteFile(dbname_ + "/" + child);
+      }
+    }
+  }
+};
+
+TEST_F(DBTest, PutGet) {
+  ASSERT_TRUE(Put("foo", "v1").ok());
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_TRUE(Put("foo", "v2").ok());
+  ASSERT_EQ("v2", Get("foo"));
+  ASSERT_TRUE(db_->Delete(WriteOptions(), "foo").ok());
+  ASSERT_EQ("NOT_FOUND", Get("foo"));
+}
+
+TEST_F(DBTest, RecoverFromLog) {
+  ASSERT_TRUE(Put("foo", "v1").ok());
+  ASSERT_TRUE(Put("baz", "v5", true).ok());
+  Reopen();
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_EQ("v5", Get("baz"));
+  // Writes after a recovery go to a new log and survive a second reopen,
+  // shadowing the older entries by sequence number.
+  ASSERT_TRUE(Put("foo", "v2").ok());
+  Reopen();
+  ASSERT_EQ("v2", Get("foo"));
+  ASSERT_EQ("v5", Get("baz"));
+}
+
+TEST_F(DBTest, RecoverManyBatches) {
+  // Keep everything in the memtable so recovery has to replay it all.
+  Options options;
+  options.write_buffer_size = 64 << 20;
+  Reopen(&options);
+
+  // Enough data to span several replay chunks.
+  const int kNum = 30000;
+  std::string value(100, 'x');
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_TRUE(Put("key" + std::to_string(i), value + std::to_string(i)).ok());
+  }
+  Reopen(&options);
+  for (int i = 0; i < kNum; i += 97) {
+    ASSERT_EQ(value + std::to_string(i), Get("key" + std::to_string(i)));
+  }
+}
+
+TEST_F(DBTest, FlushMemTableToLevel0) {
+  Options options;
+  options.write_buffer_size = 100 << 10;
+  Reopen(&options);
+
+  std::string value(1000, 'v');
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(Put("key" + std::to_string(i), value).ok());
+  }
+  // Closing waits for any flush still running in the background.
+  Reopen(&options);
+  ASSERT_GT(CountFiles(".ldb"), 0);
+  // Logs whose contents reached a table have been removed.  What is left
+  // is at most the logs behind a flush cut short by the close, the one
+  // for the active memtable, and the fresh log opened by this reopen.
+  ASSERT_LE(CountFiles(".log"), 3);
+  ASSERT_EQ(1, CountFiles("CURRENT"));
+
+  // The recorded tables survive another reopen.
+  const int tables = CountFiles(".ldb");
+  Reopen(&options);
+  ASSERT_GE(CountFiles(".ldb"), tables);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(value, Get("key" + std::to_string(i)));
+  }
+}
+
+TEST_F(DBTest, ReadFromTables) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  Reopen(&options);
+
+  // Overwrites and deletions spread over many tables and the memtables.
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 5000; i++) {
+    const std::string key = "k" + std::to_string(rnd.Uniform(500));
+    if (rnd.OneIn(4)) {
+      ASSERT_TRUE(db_->Delete(WriteOptions(), key).ok());
+      model.erase(key);
+    } else {
+      const std::string value = std::to_string(i) + std::string(200, 'v');
+      ASSERT_TRUE(Put(key, value).ok());
+      model[key] = value;
+    }
+  }
+  ASSERT_GT(CountFiles(".ldb"), 0);
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int k = 0; k < 500; k++) {
+      const std::string key = "k" + std::to_string(k);
+      auto it = model.find(key);
+      ASSERT_EQ(it == model.end() ? "NOT_FOUND" : it->second, Get(key));
+    }
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    auto it = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+      ASSERT_TRUE(it != model.end());
+      ASSERT_EQ(it->first, iter->key().ToString());
+      ASSERT_EQ(it->second, iter->value().ToString());
+    }
+    ASSERT_TRUE(it == model.end());
+    ASSERT_TRUE(iter->status().ok());
+    delete iter;
+
+    // Everything is in tables after a reopen.
+    Reopen(&options);
+  }
+}
+
+TEST_F(DBTest, FilterPolicySkipsDataBlocks) {
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  CheckFilterSkipsDataBlocks(policy.get());
+}
+
+TEST_F(DBTest, RibbonFilterPolicySkipsDataBlocks) {
+  std::unique_ptr<const FilterPolicy> policy(NewRibbonFilterPolicy(10));
+  CheckFilterSkipsDataBlocks(policy.get());
+}
+
+TEST_F(DBTest, MultipleImmutableMemTables) {
+  HoldBackgroundEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  options.write_buffer_size = 64 << 10;
+  options.max_write_buffer_number = 4;
+  Reopen(&options);
+
+  // Fill about two and a half memtables.  With flushes held back the
+  // full ones queue up instead of blocking the writer.
+  const int kNum = 150;
+  std::string value(1000, 'v');
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_TRUE(Put("key" + std::to_string(1000 + i),
+                    value + std::to_string(i)).ok());
+  }
+  ASSERT_TRUE(Put("key1000", "newest").ok());
+
+  // Reads see every memtable, newest first.
+  ASSERT_EQ("newest", Get("key1000"));
+  ASSERT_EQ(value + "1", Get("key1001"));
+  ASSERT_EQ(value + "70", Get("key1070"));
+  ASSERT_EQ(value + "149", Get("key1149"));
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  ASSERT_EQ(kNum, count);
+  delete iter;
+
+  // Everything queued so far is merged into a single table.
+  ASSERT_EQ(0, CountFiles(".ldb"));
+  env.Release();
+  for (int i = 0; i < 1000 && CountFiles(".ldb") == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(1, CountFiles(".ldb"));
+  Reopen();
+}
+
+TEST_F(DBTest, MemTableBloomFilter) {
+  HoldBackgroundEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  options.write_buffer_size = 64 << 10;
+  options.max_write_buffer_number = 4;
+  options.memtable_bloom_size_ratio = 0.1;
+  Reopen(&options);
+
+  // Spread keys over an immutable memtable and the active one.
+  for (int i = 0; CountFiles(".log") < 2; i++) {
+    ASSERT_TRUE(Put("old" + std::to_string(i), std::string(100, 'v')).ok());
+  }
+  ASSERT_TRUE(Put("new", "v").ok());
+  ASSERT_TRUE(db_->Delete(WriteOptions(), "old1").ok());
+
+  ASSERT_EQ(std::string(100, 'v'), Get("old0"));
+  ASSERT_EQ("NOT_FOUND", Get("old1"));
+  ASSERT_EQ(std::string(100, 'v'), Get("old2"));
+  ASSERT_EQ("v", Get("new"));
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ("NOT_FOUND", Get("missing" + std::to_string(i)));
+  }
+  env.Release();
+  Reopen();
+}
+
+TEST_F(DBTest, HashMemTableReps) {
+  std::unique_ptr<const SliceTransform> prefix(NewFixedPrefixTransform(4));
+  std::unique_ptr<MemTableRepFactory> factories[] = {
+      std::unique_ptr<MemTableRepFactory>(NewHashSkipListRepFactory(64)),
+      std::unique_ptr<MemTableRepFactory>(NewHashLinkListRepFactory(64))};
+  for (const auto& factory : factories) {
+    SCOPED_TRACE(factory->Name());
+    Options options;
+    options.memtable_factory = factory.get();
+    options.prefix_extractor = prefix.get();
+    Reopen(&options);
+
+    // Many keys per prefix, some shorter than the prefix, with
+    // overwrites and deletions.
+    Random rnd(301);
+    std::map<std::string, std::string> model;
+    for (int i = 0; i < 2000; i++) {
+      const std::string key = "p" + std::to_string(rnd.Uniform(30)) + "/" +
+                              std::to_string(rnd.Uniform(40));
+      if (rnd.OneIn(5)) {
+        ASSERT_TRUE(db_->Delete(WriteOptions(), key).ok());
+        model.erase(key);
+      } else {
+        const std::string value = "v" + std::to_string(i);
+        ASSERT_TRUE(Put(key, value).ok());
+        model[key] = value;
+      }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+      for (int i = 0; i < 30; i++) {
+        for (int j = 0; j < 40; j++) {
+          const std::string key =
+              "p" + std::to_string(i) + "/" + std::to_string(j);
+          auto it = model.find(key);
+          ASSERT_EQ(it == model.end() ? "NOT_FOUND" : it->second, Get(key));
+        }
+      }
+
+      // Iteration sees all buckets in order.
+      Iterator* iter = db_->NewIterator(ReadOptions());
+      auto expected = model.begin();
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+        ASSERT_TRUE(expected != model.end());
+        ASSERT_EQ(expected->first, iter->key().ToString());
+        ASSERT_EQ(expected->second, iter->value().ToString());
+      }
+      ASSERT_TRUE(expected == model.end());
+      auto rexpected = model.rbegin();
+      for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rexpected) {
+        ASSERT_TRUE(rexpected != model.rend());
+        ASSERT_EQ(rexpected->first, iter->key().ToString());
+      }
+      ASSERT_TRUE(rexpected == model.rend());
+      iter->Seek("p2");
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(model.lower_bound("p2")->first, iter->key().ToString());
+      delete iter;
+
+      // Recovery rebuilds the same rep from the log.
+      Reopen(&options);
+    }
+  }
+  Reopen();
+}
+
+TEST_F(DBTest, VectorMemTableRep) {
+  std::unique_ptr<MemTableRepFactory> factory(NewVectorRepFactory());
+  HoldBackgroundEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  options.memtable_factory = factory.get();
+  options.write_buffer_size = 1 << 20;
+  Reopen(&options);
+
+  // Load until the first memtable is frozen.  It holds enough entries
+  // to be sorted by several threads.
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int i = 0; CountFiles(".log") < 2; i++) {
+    const std::string key = "k" + std::to_string(rnd.Uniform(100000));
+    const std::string value = "v" + std::to_string(i);
+    ASSERT_TRUE(Put(key, value).ok());
+    model[key] = value;
+  }
+  ASSERT_GT(model.size(), 10000);
+
+  // Reads see the frozen memtable sorted, and the active one unsorted.
+  ASSERT_TRUE(Put("k0", "active").ok());
+  model["k0"] = "active";
+  for (int i = 0; i < 1000; i++) {
+    const std::string key = "k" + std::to_string(rnd.Uniform(100000));
+    auto it = model.find(key);
+    ASSERT_EQ(it == model.end() ? "NOT_FOUND" : it->second, Get(key));
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  auto expected = model.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+    ASSERT_TRUE(expected != model.end());
+    ASSERT_EQ(expected->first, iter->key().ToString());
+    ASSERT_EQ(expected->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(expected == model.end());
+  delete iter;
+
+  env.Release();
+  for (int i = 0; i < 1000 && CountFiles(".ldb") == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(1, CountFiles(".ldb"));
+  Reopen();
+}
+
+TEST_F(DBTest, InPlaceUpdates) {
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.inplace_update_support = true;
+  Reopen(&options);
+
+  // Far more than a memtable holds, were every overwrite a new entry.
+  for (int i = 0; i < 10000; i++) {
+    ASSERT_TRUE(Put("counter", std::to_string(100000 + i)).ok());
+    ASSERT_TRUE(Put("flag", (i % 2) ? "on" : "off").ok());
+  }
+  ASSERT_EQ(1, CountFiles(".log"));
+  ASSERT_EQ("109999", Get("counter"));
+  ASSERT_EQ("on", Get("flag"));
+
+  // Values that do not fit, and deletions, still add entries.
+  ASSERT_TRUE(Put("counter", "1000000").ok());
+  ASSERT_EQ("1000000", Get("counter"));
+  ASSERT_TRUE(db_->Delete(WriteOptions(), "flag").ok());
+  ASSERT_TRUE(Put("flag", "on").ok());
+  ASSERT_EQ("on", Get("flag"));
+  ASSERT_TRUE(Put("flag", "off").ok());
+  ASSERT_EQ("off", Get("flag"));
+
+  // The log has every write, so recovery replays to the same values.
+  Reopen(&options);
+  ASSERT_EQ("1000000", Get("counter"));
+  ASSERT_EQ("off", Get("flag"));
+}
+
+TEST_F(DBTest, WriteBufferManagerFlushesLargestMemTable) {
+  // Neither DB would flush on its own.
+  WriteBufferManager manager(256 << 10);
+  Options options;
+  options.arena_block_size = 16 << 10;
+  options.write_buffer_manager = &manager;
+  Reopen(&options);
+
+  const std::string other_name = dbname_ + "_other";
+  std::vector<std::string> children;
+  env_->GetChildren(other_name, &children);
+  for (const std::string& child : children) {
+    env_->DeleteFile(other_name + "/" + child);
+  }
+  Options other_options = options;
+  other_options.create_if_missing = true;
+  DB* other;
+  ASSERT_TRUE(DB::Open(other_options, other_name, &other).ok());
+  auto other_tables = [&]() {
+    env_->GetChildren(other_name, &children);
+    int count = 0;
+    for (const std::string& child : children) {
+      if (child.size() > 4 &&
+          child.compare(child.size() - 4, 4, ".ldb") == 0) {
+        count++;
+      }
+    }
+    return count;
+  };
+
+  std::string value(1000, 'v');
+  for (int i = 0; i < 150; i++) {
+    ASSERT_TRUE(other->Put(WriteOptions(), "o" + std::to_string(i), value)
+                    .ok());
+  }
+  ASSERT_GT(manager.memory_usage(), size_t{150 << 10});
+  ASSERT_EQ(0, other_tables());
+
+  // Writes to this DB take the pair over budget, and the other DB, idle
+  // by then, holds the largest memtable.
+  for (int i = 0; i < 2000; i++) {
+    ASSERT_TRUE(Put("k" + std::to_string(i), value).ok());
+  }
+  for (int i = 0; i < 1000 && other_tables() == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(1, other_tables());
+  ASSERT_GT(CountFiles(".ldb"), 0);
+
+  // Once the flushes are done, what is left fits the budget.
+  for (int i = 0; i < 1000 && manager.memory_usage() > manager.buffer_size();
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_LE(manager.memory_usage(), manager.buffer_size());
+
+  delete other;
+  Reopen();
+  env_->GetChildren(other_name, &children);
+  for (const std::string& child : children) {
+    env_->DeleteFile(other_name + "/" + child);
+  }
+}
+
+TEST_F(DBTest, SlowdownWhileMemTablesQueueUp) {
+  HoldBackgroundEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  options.write_buffer_size = 64 << 10;
+  options.max_write_buffer_number = 4;
+  options.delayed_write_rate = 256 << 10;
+  Reopen(&options);
+
+  // Fill memtables until three wait to be flushed, which is one short
+  // of the limit, so writes slow down.  Each memtable has its own log.
+  std::string value(1000, 'v');
+  for (int i = 0; CountFiles(".log") < 4; i++) {
+    ASSERT_TRUE(Put("a" + std::to_string(i), value).ok());
+  }
+
+  // Small writes that fit into the active memtable now trickle in at
+  // about the delayed rate instead of all at once.
+  const int kDelayed = 100;
+  std::string small_value(100, 's');
+  const uint64_t start = env.NowMicros();
+  for (int i = 0; i < kDelayed; i++) {
+    ASSERT_TRUE(Put("b" + std::to_string(i), small_value).ok());
+  }
+  const uint64_t elapsed = env.NowMicros() - start;
+  const uint64_t expected =
+      kDelayed * small_value.size() * 1000000 / options.delayed_write_rate;
+  ASSERT_GE(elapsed, expected / 2);
+
+  ASSERT_EQ(value, Get("a0"));
+  ASSERT_EQ(small_value, Get("b99"));
+  env.Release();
+  Reopen();
+}
+
+TEST_F(DBTest, Level0FilesDoNotSlowDownByDefault) {
+  // Nothing compacts level 0 yet, so a limit on its files would hold
+  // back every write once reached.
+  Options options;
+  options.write_buffer_size = 64 << 10;
+  options.delayed_write_rate = 16 << 10;
+  Reopen(&options);
+
+  // At the delayed rate, the writes past the eighth file alone would
+  // take half a minute.
+  std::string value(1000, 'v');
+  const uint64_t start = env_->NowMicros();
+  int i = 0;
+  for (; CountFiles(".ldb") < 16; i++) {
+    ASSERT_TRUE(Put("k" + std::to_string(i), value).ok());
+  }
+  ASSERT_LT(env_->NowMicros() - start, uint64_t{10000000});
+  ASSERT_EQ(value, Get("k0"));
+  ASSERT_EQ(value, Get("k" + std::to_string(i - 1)));
+}
+
+TEST_F(DBTest, ConcurrentWritersReadTheirWrites) {
+  // A write is only acknowledged once its group's sequence numbers are
+  // visible, even while later groups are already being logged.
+  const int kThreads = 8;
+  const int kPerThread = 500;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([this, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        std::string key = std::to_string(t) + "." + std::to_string(i);
+        ASSERT_TRUE(Put(key, key).ok());
+        ASSERT_EQ(key, Get(key));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  ASSERT_EQ(kThreads * kPerThread, count);
+  delete iter;
+}
+
+TEST_F(DBTest, ConcurrentWritersAcrossMemTableSwitches) {
+  // Memtable switches wait for groups still being applied to the old
+  // memtable.  Flushes are held back so everything stays readable.
+  HoldBackgroundEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  options.write_buffer_size = 64 << 10;
+  options.max_write_buffer_number = 64;
+  Reopen(&options);
+
+  const int kThreads = 8;
+  const int kPerThread = 300;
+  std::string value(100, 'v');
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([this, t, &value]() {
+      for (int i = 0; i < kPerThread; i++) {
+        std::string key = std::to_string(t) + "." + std::to_string(i);
+        ASSERT_TRUE(Put(key, value + key, (i % 50) == 0).ok());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < kThreads; t++) {
+    for (int i = 0; i < kPerThread; i++) {
+      std::string key = std::to_string(t) + "." + std::to_string(i);
+      ASSERT_EQ(value + key, Get(key));
+    }
+  }
+  env.Release();
+  Reopen();
+}
+
+TEST_F(DBTest, ConcurrentSyncWriters) {
+  const int kThreads = 8;
+  const int kPerThread = 200;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([this, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        std::string key = std::to_string(t) + "." + std::to_string(i);
+        ASSERT_TRUE(Put(key, key, (i % 2) == 0).ok());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  Reopen();
+  for (int t = 0; t < kThreads; t++) {
+    for (int i = 0; i < kPerThread; i++) {
+      std::string key = std::to_string(t) + "." + std::to_string(i);
+      ASSERT_EQ(key, Get(key));
+    }
+  }
+}
+
+TEST_F(DBTest, AsyncWritesAndGets) {
+  const int kThreads = 4;
+  const int kPerThread = 500;
+  std::mutex mu;
+  std::condition_variable cv;
+  int pending = 0;
+  Status first_error;
+  auto done = [&](const Status& s) {
+    std::lock_guard<std::mutex> l(mu);
+    if (!s.ok() && first_error.ok()) {
+      first_error = s;
+    }
+    if (--pending == 0) {
+      cv.notify_all();
+    }
+  };
+  auto wait = [&]() {
+    std::unique_lock<std::mutex> l(mu);
+    cv.wait(l, [&]() { return pending == 0; });
+  };
+
+  // Async writers only return once their callbacks have run, so their
+  // batches stay put; a sync writer joins in to mix leaders of both
+  // kinds into the groups.
+  std::vector<WriteBatch> batches(kThreads * kPerThread);
+  pending = kThreads * kPerThread;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        std::string key = std::to_string(t) + "." + std::to_string(i);
+        WriteBatch* batch = &batches[t * kPerThread + i];
+        batch->Put(key, key);
+        WriteOptions options;
+        options.sync = (i % 100) == 0;
+        db_->WriteAsync(options, batch, done);
+      }
+    });
+  }
+  threads.emplace_back([this]() {
+    for (int i = 0; i < kPerThread; i++) {
+      ASSERT_TRUE(Put("sync." + std::to_string(i), "s").ok());
+    }
+  });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  wait();
+  ASSERT_TRUE(first_error.ok()) << first_error.ToString();
+
+  std::vector<std::string> values(kThreads * kPerThread);
+  pending = kThreads * kPerThread;
+  for (int t = 0; t < kThreads; t++) {
+    for (int i = 0; i < kPerThread; i++) {
+      std::string key = std::to_string(t) + "." + std::to_string(i);
+      std::string* value = &values[t * kPerThread + i];
+      db_->GetAsync(ReadOptions(), key,
+                    [&, value](const Status& s, const std::string& v) {
+                      *value = v;
+                      done(s);
+                    });
+    }
+  }
+  wait();
+  ASSERT_TRUE(first_error.ok()) << first_error.ToString();
+  for (int t = 0; t < kThreads; t++) {
+    for (int i = 0; i < kPerThread; i++) {
+      ASSERT_EQ(std::to_string(t) + "." + std::to_string(i),
+                values[t * kPerThread + i]);
+    }
+  }
+  ASSERT_EQ("s", Get("sync.0"));
+}
+
+TEST_F(DBTest, WriteAsyncDoesNotLeadOnTheCallingThread) {
+  BlockLogSyncEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  Reopen(&options);
+
+  // The DB is idle, so this write leads its own group, and the log sync
+  // it asks for is held.  WriteAsync returns all the same.
+  std::mutex mu;
+  std::condition_variable cv;
+  bool done = false;
+  Status status;
+  WriteBatch batch;
+  batch.Put("k", "v");
+  WriteOptions write_options;
+  write_options.sync = true;
+  db_->WriteAsync(write_options, &batch, [&](const Status& s) {
+    std::lock_guard<std::mutex> l(mu);
+    status = s;
+    done = true;
+    cv.notify_all();
+  });
+  env.WaitForBlockedSync();
+  {
+    std::lock_guard<std::mutex> l(mu);
+    ASSERT_FALSE(done);
+  }
+
+  env.Release();
+  {
+    std::unique_lock<std::mutex> l(mu);
+    cv.wait(l, [&]() { return done; });
+  }
+  ASSERT_TRUE(status.ok()) << status.ToString();
+  ASSERT_EQ("v", Get("k"));
+  Reopen();
+}
+
+TEST_F(DBTest, GetAsyncDoesNotWaitForWriteLeaders) {
+  BlockLogSyncEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  Reopen(&options);
+  ASSERT_TRUE(Put("a", "1").ok());
+
+  // Hold a detached write leader in its log sync.
+  std::mutex mu;
+  std::condition_variable cv;
+  bool written = false;
+  WriteBatch batch;
+  batch.Put("b", "2");
+  WriteOptions write_options;
+  write_options.sync = true;
+  db_->WriteAsync(write_options, &batch, [&](const Status& s) {
+    std::lock_guard<std::mutex> l(mu);
+    written = true;
+    cv.notify_all();
+  });
+  env.WaitForBlockedSync();
+
+  bool read = false;
+  std::string value;
+  db_->GetAsync(ReadOptions(), "a", [&](const Status& s, const std::string& v) {
+    std::lock_guard<std::mutex> l(mu);
+    value = v;
+    read = true;
+    cv.notify_all();
+  });
+  {
+    std::unique_lock<std::mutex> l(mu);
+    const bool served =
+        cv.wait_for(l, std::chrono::seconds(10), [&]() { return read; });
+    l.unlock();
+    if (!served) {
+      env.Release();
+    }
+    ASSERT_TRUE(served);
+  }
+  ASSERT_EQ("1", value);
+
+  env.Release();
+  {
+    std::unique_lock<std::mutex> l(mu);
+    cv.wait(l, [&]() { return written; });
+  }
+  ASSERT_EQ("2", Get("b"));
+  Reopen();
+}
+
+TEST_F(DBTest, LogWriteErrorsUnderConcurrentWriters) {
+  // Followers of a failed group write again as soon as they complete,
+  // from the same stack slot or from memory freed with a detached
+  // writer, so the queue must no longer point at them by then.
+  FailLogAppendsEnv env(Env::Default());
+  Options options;
+  options.env = &env;
+  Reopen(&options);
+  env.SetFail(true);
+
+  const int kThreads = 8;
+  const int kPerThread = 500;
+  std::mutex mu;
+  std::condition_variable cv;
+  int pending = kThreads * kPerThread / 2;
+  std::atomic<int> failed{0};
+  auto done = [&](const Status& s) {
+    if (!s.ok()) {
+      failed.fetch_add(1);
+    }
+    std::lock_guard<std::mutex> l(mu);
+    if (--pending == 0) {
+      cv.notify_all();
+    }
+  };
+
+  std::vector<WriteBatch> batches(kThreads * kPerThread);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        std::string key = std::to_string(t) + "." + std::to_string(i);
+        if (i % 2 == 0) {
+          if (!Put(key, key, (i % 4) == 0).ok()) {
+            failed.fetch_add(1);
+          }
+        } else {
+          WriteBatch* batch = &batches[t * kPerThread + i];
+          batch->Put(key, key);
+          db_->WriteAsync(WriteOptions(), batch, done);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  {
+    std::unique_lock<std::mutex> l(mu);
+    ASSERT_TRUE(cv.wait_for(l, std::chrono::seconds(60),
+                            [&]() { return pending == 0; }));
+  }
+  ASSERT_EQ(kThreads * kPerThread, failed.load());
+
+  // The failures leave nothing behind that holds up later writes.
+  env.SetFail(false);
+  ASSERT_TRUE(Put("after", "x").ok());
+  ASSERT_EQ("x", Get("after"));
+  ASSERT_EQ("NOT_FOUND", Get("0.0"));
+  Reopen();
+}
+
+TEST_F(DBTest, AsyncWritesWithWriteBufferManager) {
+  // The manager asks for flushes while detached writers hold the write
+  // queue, so the switches have to queue up behind them.
+  WriteBufferManager manager(64 << 10);
+  Options options;
+  options.arena_block_size = 16 << 10;
+  options.write_buffer_manager = &manager;
+  Reopen(&options);
+
+  const int kThreads = 4;
+  const int kPerThread = 200;
+  std::mutex mu;
+  std::condition_variable cv;
+  int pending = kThreads * kPerThread;
+  Status first_error;
+  auto done = [&](const Status& s) {
+    std::lock_guard<std::mutex> l(mu);
+    if (!s.ok() && first_error.ok()) {
+      first_error = s;
+    }
+    if (--pending == 0) {
+      cv.notify_all();
+    }
+  };
+
+  const std::string value(1000, 'v');
+  std::vector<WriteBatch> batches(kThreads * kPerThread);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        WriteBatch* batch = &batches[t * kPerThread + i];
+        batch->Put(std::to_string(t) + "." + std::to_string(i), value);
+        db_->WriteAsync(WriteOptions(), batch, done);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  {
+    std::unique_lock<std::mutex> l(mu);
+    ASSERT_TRUE(cv.wait_for(l, std::chrono::seconds(60),
+                            [&]() { return pending == 0; }));
+  }
+  ASSERT_TRUE(first_error.ok()) << first_error.ToString();
+
+  // Synchronous writes still get through once the async ones are done.
+  ASSERT_TRUE(Put("after", "x").ok());
+  ASSERT_EQ("x", Get("after"));
+  for (int t = 0; t < kThreads; t++) {
+    for (int i = 0; i < kPerThread; i++) {
+      ASSERT_EQ(value, Get(std::to_string(t) + "." + std::to_string(i)));
+    }
+  }
+  ASSERT_GT(CountFiles(".ldb"), 0);
+  Reopen();
+}
+
+}  // namespace minilsm
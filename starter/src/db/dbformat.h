@@ -6,6 +6,7 @@
 #include <string>
 
 #include "minilsm/comparator.h"
+#include "minilsm/filter_policy.h"
 #include "minilsm/slice.h"
 #include "util/coding.h"
 #include "util/logging.h"
@@ -14,6 +15,9 @@ namespace minilsm {
 
 namespace config {
 static const int kNumLevels = 7;
+
+// Level-0 compaction is started when we hit this many files.
+static const int kL0_CompactionTrigger = 4;
 // Approximate gap in bytes between samples of data read during iteration.
 static const int kReadBytesPeriod = 1 << 20;
 }
@@ -83,6 +87,18 @@ class InternalKeyComparator : public Comparator {
   int Compare(const InternalKey& a, const InternalKey& b) const;
 };
 
+// Filter policy wrapper that converts from internal keys to user keys
+class InternalFilterPolicy : public FilterPolicy {
+ private:
+  const FilterPolicy* const user_policy_;
+
+ public:
+  explicit InternalFilterPolicy(const FilterPolicy* p) : user_policy_(p) {}
+  const char* Name() const override;
+  void CreateFilter(const Slice* keys, int n, std::string* dst) const override;
+  bool KeyMayMatch(const Slice& key, const Slice& filter) const override;
+};
+
 // Modules in this directory should keep internal keys wrapped inside
 // the following class instead of plain strings so that we do not
 // incorrectly use string comparisons instead of an InternalKeyComparator.
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <vector>
+
+#include "db/dbformat.h"
+#include "db/skiplist.h"
+#include "db/sorted_rep_iterator.h"
+#include "minilsm/memtablerep.h"
+#include "minilsm/slice_transform.h"
+#include "util/arena.h"
+#include "util/coding.h"
+
+namespace minilsm {
+
+namespace {
+
+// The user key of an entry, which starts with its length-prefixed
+// internal key.
+Slice UserKey(const char* entry) {
+  uint32_t internal_key_size;
+  const char* p = GetVarint32Ptr(entry, entry + 5, &internal_key_size);
+  return Slice(p, internal_key_size - 8);
+}
+
+// Spreads entries over a fixed array of buckets by the prefix of their
+// user key.  Every entry of a user key lands in the same bucket, so a
+// point lookup only searches one bucket.  Iterating over the whole rep
+// sorts all of its entries.
+template <typename Bucket>
+class HashRep : public MemTableRep {
+ public:
+  HashRep(const MemTableRep::KeyComparator& compare, Arena* arena,
+          const SliceTransform* prefix_extractor, size_t bucket_count)
+      : MemTableRep(arena),
+        compare_(compare),
+        prefix_extractor_(prefix_extractor),
+        bucket_count_(bucket_count),
+        buckets_(reinterpret_cast<std::atomic<Bucket*>*>(
+            arena->AllocateAligned(sizeof(std::atomic<Bucket*>) *
+                                   bucket_count))) {
+    for (size_t i = 0; i < bucket_count_; i++) {
+      new (&buckets_[i]) std::atomic<Bucket*>(nullptr);
+    }
+  }
+
+  MemTableRep::Iterator* GetIterator() override {
+    std::vector<const char*> entries;
+    for (size_t i = 0; i < bucket_count_; i++) {
+      Bucket* bucket = buckets_[i].load(std::memory_order_acquire);
+      if (bucket != nullptr) {
+        CollectEntries(bucket, &entries);
+      }
+    }
+    return new SortedRepIterator(&entries, compare_);
+  }
+
+ protected:
+  std::atomic<Bucket*>* BucketFor(const Slice& user_key) const {
+    Slice prefix = user_key;
+    if (prefix_extractor_->InDomain(user_key)) {
+      prefix = prefix_extractor_->Transform(user_key);
+    }
+    const size_t hash = std::hash<std::string_view>()(
+        std::string_view(prefix.data(), prefix.size()));
+    return &buckets_[hash % bucket_count_];
+  }
+
+  virtual void CollectEntries(Bucket* bucket,
+                              std::vector<const char*>* entries) const = 0;
+
+  const MemTableRep::KeyComparator& compare_;
+
+ private:
+  const SliceTransform* const prefix_extractor_;
+  const size_t bucket_count_;
+  std::atomic<Bucket*>* const buckets_;
+};
+
+typedef SkipList<const char*, const MemTableRep::KeyComparator&>
+    SkipListBucket;
+
+class HashSkipListRep : public HashRep<SkipListBucket> {
+ public:
+  using HashRep::HashRep;
+
+  void Insert(const char* entry) override {
+    std::atomic<SkipListBucket*>* slot = BucketFor(UserKey(entry));
+    SkipListBucket* bucket = slot->load(std::memory_order_relaxed);
+    if (bucket == nullptr) {
+      bucket = new (arena_->AllocateAligned(sizeof(SkipListBucket)))
+          SkipListBucket(compare_, arena_);
+      slot->store(bucket, std::memory_order_release);
+    }
+    bucket->Insert(entry);
+  }
+
+  bool Contains(const char* key) const override {
+    SkipListBucket* bucket =
+        BucketFor(UserKey(key))->load(std::memory_order_acquire);
+    return bucket != nullptr && bucket->Contains(key);
+  }
+
+  void Get(const LookupKey& k, void* arg,
+           bool (*callback)(void* arg, const char* entry)) override {
+    SkipListBucket* bucket =
+        BucketFor(k.user_key())->load(std::memory_order_acquire);
+    if (bucket == nullptr) {
+      return;
+    }
+    SkipListBucket::Iterator iter(bucket);
+    for (iter.Seek(k.memtable_key().data());
+         iter.Valid() && callback(arg, iter.key()); iter.Next()) {
+    }
+  }
+
+ protected:
+  void CollectEntries(SkipListBucket* bucket,
+                      std::vector<const char*>* entries) const override {
+    SkipListBucket::Iterator iter(bucket);
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+      entries->push_back(iter.key());
+    }
+  }
+};
+
+// A node of a sorted linked list, followed by its entry.
+struct ListNode {
+  std::atomic<ListNode*> next;
+
+  const char* Key() const { return reinterpret_cast<const char*>(this + 1); }
+};
+
+// Each bucket points at the first node of its list.
+class HashLinkListRep : public HashRep<ListNode> {
+ public:
+  using HashRep::HashRep;
+
+  char* Allocate(size_t len, bool concurrent) override {
+    const size_t bytes = sizeof(ListNode) + len;
+    char* const raw = concurrent ? arena_->AllocateAlignedShared(bytes)
+                                 : arena_->AllocateAligned(bytes);
+    return const_cast<char*>((new (raw) ListNode)->Key());
+  }
+
+  void Insert(const char* entry) override {
+    ListNode* x = reinterpret_cast<ListNode*>(const_cast<char*>(entry)) - 1;
+    std::atomic<ListNode*>* link = BucketFor(UserKey(entry));
+    ListNode* next = link->load(std::memory_order_relaxed);
+    while (next != nullptr && compare_(next->Key(), entry) < 0) {
+      link = &next->next;
+      next = link->load(std::memory_order_relaxed);
+    }
+    assert(next == nullptr || compare_(next->Key(), entry) != 0);
+    // Readers that see x see its link.
+    x->next.store(next, std::memory_order_relaxed);
+    link->store(x, std::memory_order_release);
+  }
+
+  bool Contains(const char* key) const override {
+    ListNode* x = FindGreaterOrEqual(key);
+    return x != nullptr && compare_(x->Key(), key) == 0;
+  }
+
+  void Get(const LookupKey& k, void* arg,
+           bool (*callback)(void* arg, const char* entry)) override {
+    for (ListNode* x = FindGreaterOrEqual(k.memtable_key().data());
+         x != nullptr && callback(arg, x->Key());
+         x = x->next.load(std::memory_order_acquire)) {
+    }
+  }
+
+ protected:
+  void CollectEntries(ListNode* x,
+                      std::vector<const char*>* entries) const override {
+    for (; x != nullptr; x = x->next.load(std::memory_order_acquire)) {
+      entries->push_back(x->Key());
+    }
+  }
+
+ private:
+  // The first node of the bucket of key at or after key, or nullptr.
+  ListNode* FindGreaterOrEqual(const char* key) const {
+    ListNode* x = BucketFor(UserKey(key))->load(std::memory_order_acquire);
+    while (x != nullptr && compare_(x->Key(), key) < 0) {
+      x = x->next.load(std::memory_order_acquire);
+    }
+    return x;
+  }
+};
+
+template <typename Rep>
+class HashRepFactory : public MemTableRepFactory {
+ public:
+  HashRepFactory(const char* name, size_t bucket_count)
+      : name_(name), bucket_count_(bucket_count) {}
+
+  MemTableRep* CreateMemTableRep(
+      const MemTableRep::KeyComparator& compare, Arena* arena,
+      const SliceTransform* prefix_extractor) const override {
+    if (prefix_extractor == nullptr) {
+      return SkipListFactory().CreateMemTableRep(compare, arena, nullptr);
+    }
+    return new Rep(compare, arena, prefix_extractor, bucket_count_);
+  }
+
+  const char* Name() const override { return name_; }
+
+ private:
+  const char* const name_;
+  const size_t bucket_count_;
+};
+
+}  // namespace
+
+MemTableRepFactory* NewHashSkipListRepFactory(size_t bucket_count) {
+  return new HashRepFactory<HashSkipListRep>("HashSkipListRepFactory",
+                                             std::max<size_t>(bucket_count, 1));
+}
+
+MemTableRepFactory* NewHashLinkListRepFactory(size_t bucket_count) {
+  return new HashRepFactory<HashLinkListRep>("HashLinkListRepFactory",
+                                             std::max<size_t>(bucket_count, 1));
+}
+
+}  // namespace minilsm
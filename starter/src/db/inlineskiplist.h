@@ -0,0 +1,492 @@
+#ifndef MINILSM_DB_INLINESKIPLIST_H_
+#define MINILSM_DB_INLINESKIPLIST_H_
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>  // for std::hash
+#include <thread>
+
+#include "util/arena.h"
+#include "util/random.h"
+
+namespace minilsm {
+
+// InlineSkipList is a SkipList over keys that live inside its nodes.
+// A node is a single allocation: the links of its upper levels, the
+// level-0 link, a cached key prefix, then the key bytes.  Callers get
+// the key buffer from AllocateKey(), encode the key into it and then
+// Insert() it, so following a link lands next to the key it leads to
+// instead of one more pointer away from it.
+//
+// Comparator must provide
+//   int operator()(const char* a, const char* b) const;
+//   uint64_t Prefix(const char* key) const;
+// where Prefix orders keys consistently with operator(): if
+// Prefix(a) < Prefix(b) then a < b.  Searches compare the cached
+// prefixes first and only read a node's key when they are equal.  A
+// comparator without a useful prefix may return the same value for
+// every key.
+//
+// Thread safety is that of SkipList: writes require external
+// synchronization unless they all go through InsertConcurrently, and
+// reads only require that the list outlives them.
+template <class Comparator>
+class InlineSkipList {
+private:
+  struct Node;
+public:
+  explicit InlineSkipList(Comparator cmp, Arena* arena);
+  InlineSkipList(const InlineSkipList&) = delete;
+  InlineSkipList& operator=(const InlineSkipList&) = delete;
+
+  // Allocate a node for a key of key_size bytes and return the buffer
+  // to encode the key into.  If concurrent is true, the node comes from
+  // the arena's thread-safe path.
+  char* AllocateKey(size_t key_size, bool concurrent = false);
+
+  // Insert a key allocated by AllocateKey().
+  // REQUIRES: nothing that compares equal to key is in the list
+  void Insert(const char* key);
+
+  // Like Insert, but safe to call from several threads at once, for
+  // keys allocated with concurrent set.  Must not run concurrently with
+  // Insert.
+  void InsertConcurrently(const char* key);
+
+  bool Contains(const char* key) const;
+
+  class Iterator {
+  public:
+    // the returned iterator is invalid
+    explicit Iterator(const InlineSkipList* list);
+
+    bool Valid() const;
+    const char* key() const;
+    void Next();
+    void Prev();
+    // Advance to the first entry with a key >= target
+    void Seek(const char* target);
+    // Position at the first entry in list.
+    // Final state of iterator is Valid() iff list is not empty.
+    void SeekToFirst();
+
+    // Position at the last entry in list.
+    // Final state of iterator is Valid() iff list is not empty.
+    void SeekToLast();
+
+   private:
+    const InlineSkipList* list_;
+    Node* node_;
+    // Intentionally copyable
+  };
+
+private:
+  enum { kMaxHeight = 12 };
+  inline int GetMaxHeight() const {
+    return max_height_.load(std::memory_order_relaxed);
+  }
+  static int RandomHeight();
+
+  // Compare the key of n with key, whose prefix is key_prefix.
+  int CompareNode(const Node* n, const char* key, uint64_t key_prefix) const {
+    if (n->prefix != key_prefix) {
+      return n->prefix < key_prefix ? -1 : +1;
+    }
+    return compare_(n->Key(), key);
+  }
+
+  // Return true if key is greater than the data stored in "n"
+  bool KeyIsAfterNode(const char* key, uint64_t key_prefix, Node* n) const {
+    return (n != nullptr) && (CompareNode(n, key, key_prefix) < 0);
+  }
+
+  // Return the earliest node that comes at or after key.
+  // Return nullptr if there is no such node.
+  //
+  // If prev is non-null, fills prev[level] with pointer to previous
+  // node at "level" for every level in [0..max_height_-1].
+  Node* FindGreaterOrEqual(const char* key, Node** prev) const;
+
+  // Starting from "before", which must sort before key, find the
+  // neighbours of key at the given level: *out_prev < key <= *out_next.
+  void FindSpliceForLevel(const char* key, uint64_t key_prefix, Node* before,
+                          int level, Node** out_prev, Node** out_next) const;
+
+  // Return the latest node with a key < key.
+  // Return head_ if there is no such node.
+  Node* FindLessThan(const char* key) const;
+
+  // Return the last node in the list.
+  // Return head_ if list is empty.
+  Node* FindLast() const;
+
+  Node* AllocateNode(size_t key_size, int height, bool concurrent);
+
+  // Whether key, whose prefix is key_prefix, falls between
+  // splice_prev_[level] and splice_next_[level].
+  bool SpliceBrackets(const char* key, uint64_t key_prefix, int level) const {
+    return (splice_prev_[level] == head_ ||
+            CompareNode(splice_prev_[level], key, key_prefix) < 0) &&
+           (splice_next_[level] == nullptr ||
+            CompareNode(splice_next_[level], key, key_prefix) > 0);
+  }
+
+  Comparator const compare_;  // Immutable after construction
+  Arena* const arena_;
+  Node* const head_;
+
+  std::atomic<int> max_height_;
+
+  // Where Insert() linked the last key, RW only by Insert(): at every
+  // level below splice_height_, splice_next_[i] directly follows
+  // splice_prev_[i], and the last key falls between them.  The next
+  // insert starts its search from the lowest level that brackets its
+  // key, so ascending inserts skip the descent from head_.
+  Node* splice_prev_[kMaxHeight];
+  Node* splice_next_[kMaxHeight];
+  int splice_height_;
+  // Set by InsertConcurrently(), whose inserts the splice misses.
+  std::atomic<bool> splice_stale_;
+};
+
+// The links of the upper levels are laid out below the Node, in
+// reverse: next_[-1] is level 1 and so on.  The key follows the Node,
+// so next_ must stay its first member and prefix its last.
+template <class Comparator>
+struct InlineSkipList<Comparator>::Node {
+private:
+  std::atomic<Node*> next_[1];
+
+public:
+  // Until the node is linked, next_[0] holds its height.
+  void StashHeight(int height) {
+    static_assert(sizeof(int) <= sizeof(next_[0]), "");
+    std::memcpy(static_cast<void*>(&next_[0]), &height, sizeof(int));
+  }
+  int UnstashHeight() const {
+    int height;
+    std::memcpy(&height, static_cast<const void*>(&next_[0]), sizeof(int));
+    return height;
+  }
+
+  const char* Key() const { return reinterpret_cast<const char*>(this + 1); }
+
+  Node* Next(int n) {
+    assert(n >= 0);
+    return (&next_[0] - n)->load(std::memory_order_acquire);
+  }
+  void SetNext(int n, Node* x) {
+    assert(n >= 0);
+    (&next_[0] - n)->store(x, std::memory_order_release);
+  }
+
+  Node* NoBarrier_Next(int n) {
+    assert(n >= 0);
+    return (&next_[0] - n)->load(std::memory_order_relaxed);
+  }
+  void NoBarrier_SetNext(int n, Node* x) {
+    assert(n >= 0);
+    (&next_[0] - n)->store(x, std::memory_order_relaxed);
+  }
+
+  // Replace the link at level n with x iff it still points at expected.
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return (&next_[0] - n)->compare_exchange_strong(
+        expected, x, std::memory_order_release);
+  }
+
+  // Set before the node is linked, immutable after.
+  uint64_t prefix;
+};
+
+template <class Comparator>
+typename InlineSkipList<Comparator>::Node*
+InlineSkipList<Comparator>::AllocateNode(size_t key_size, int height,
+                                         bool concurrent) {
+  const size_t links = sizeof(std::atomic<Node*>) * (height - 1);
+  const size_t bytes = links + sizeof(Node) + key_size;
+  char* const raw = concurrent ? arena_->AllocateAlignedShared(bytes)
+                               : arena_->AllocateAligned(bytes);
+  Node* x = reinterpret_cast<Node*>(raw + links);
+  x->StashHeight(height);
+  return x;
+}
+
+template <class Comparator>
+char* InlineSkipList<Comparator>::AllocateKey(size_t key_size,
+                                              bool concurrent) {
+  Node* x = AllocateNode(key_size, RandomHeight(), concurrent);
+  return const_cast<char*>(x->Key());
+}
+
+template <class Comparator>
+inline InlineSkipList<Comparator>::Iterator::Iterator(
+    const InlineSkipList* list) {
+  list_ = list;
+  node_ = nullptr;
+}
+
+template <class Comparator>
+inline bool InlineSkipList<Comparator>::Iterator::Valid() const {
+  return node_ != nullptr;
+}
+
+template <class Comparator>
+inline const char* InlineSkipList<Comparator>::Iterator::key() const {
+  assert(Valid());
+  return node_->Key();
+}
+
+template <class Comparator>
+inline void InlineSkipList<Comparator>::Iterator::Next() {
+  assert(Valid());
+  node_ = node_->Next(0);
+}
+
+template <class Comparator>
+inline void InlineSkipList<Comparator>::Iterator::Prev() {
+  assert(Valid());
+  node_ = list_->FindLessThan(node_->Key());
+  if (node_ == list_->head_) {
+    node_ = nullptr;
+  }
+}
+
+template <class Comparator>
+inline void InlineSkipList<Comparator>::Iterator::Seek(const char* target) {
+  node_ = list_->FindGreaterOrEqual(target, nullptr);
+}
+
+template <class Comparator>
+inline void InlineSkipList<Comparator>::Iterator::SeekToFirst() {
+  node_ = list_->head_->Next(0);
+}
+
+template <class Comparator>
+inline void InlineSkipList<Comparator>::Iterator::SeekToLast() {
+  node_ = list_->FindLast();
+  if (node_ == list_->head_) {
+    node_ = nullptr;
+  }
+}
+
+template <class Comparator>
+int InlineSkipList<Comparator>::RandomHeight() {
+  // Shared by Insert and InsertConcurrently, so every thread draws
+  // from its own generator.
+  static thread_local Random rnd(static_cast<uint32_t>(
+      std::hash<std::thread::id>()(std::this_thread::get_id())));
+  static const unsigned int kBranching = 4;
+  int height = 1;
+  while (height < kMaxHeight && rnd.OneIn(kBranching)) {
+    height++;
+  }
+  assert(height > 0);
+  assert(height <= kMaxHeight);
+  return height;
+}
+
+template <class Comparator>
+typename InlineSkipList<Comparator>::Node*
+InlineSkipList<Comparator>::FindGreaterOrEqual(const char* key,
+                                               Node** prev) const {
+  const uint64_t key_prefix = compare_.Prefix(key);
+  Node* x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    Node* next = x->Next(level);
+    if (KeyIsAfterNode(key, key_prefix, next)) {
+      x = next;
+    } else {
+      if (prev != nullptr) prev[level] = x;
+      if (level == 0) {
+        return next;
+      } else {
+        level--;
+      }
+    }
+  }
+}
+
+template <class Comparator>
+void InlineSkipList<Comparator>::FindSpliceForLevel(const char* key,
+                                                    uint64_t key_prefix,
+                                                    Node* before, int level,
+                                                    Node** out_prev,
+                                                    Node** out_next) const {
+  while (true) {
+    Node* next = before->Next(level);
+    if (!KeyIsAfterNode(key, key_prefix, next)) {
+      *out_prev = before;
+      *out_next = next;
+      return;
+    }
+    before = next;
+  }
+}
+
+template <class Comparator>
+typename InlineSkipList<Comparator>::Node*
+InlineSkipList<Comparator>::FindLessThan(const char* key) const {
+  const uint64_t key_prefix = compare_.Prefix(key);
+  Node* x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    assert(x == head_ || CompareNode(x, key, key_prefix) < 0);
+    Node* next = x->Next(level);
+    if (next == nullptr || CompareNode(next, key, key_prefix) >= 0) {
+      if (level == 0) {
+        return x;
+      } else {
+        level--;
+      }
+    } else {
+      x = next;
+    }
+  }
+}
+
+template <class Comparator>
+typename InlineSkipList<Comparator>::Node*
+InlineSkipList<Comparator>::FindLast() const {
+  Node* x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    Node* next = x->Next(level);
+    if (next != nullptr) {
+      x = next;
+    } else {
+      if (level == 0) {
+        return x;
+      } else {
+        level--;
+      }
+    }
+  }
+}
+
+template <class Comparator>
+InlineSkipList<Comparator>::InlineSkipList(Comparator cmp, Arena* arena)
+    : compare_(cmp),
+      arena_(arena),
+      head_(AllocateNode(0, kMaxHeight, false)),
+      max_height_(1),
+      splice_height_(0),
+      splice_stale_(false) {
+  head_->prefix = 0;
+  for (int i = 0; i < kMaxHeight; i++) {
+    head_->SetNext(i, nullptr);
+  }
+}
+
+template <class Comparator>
+void InlineSkipList<Comparator>::Insert(const char* key) {
+  Node* x = reinterpret_cast<Node*>(const_cast<char*>(key)) - 1;
+  const int height = x->UnstashHeight();
+  x->prefix = compare_.Prefix(key);
+
+  Node** const prev = splice_prev_;
+  Node** const next = splice_next_;
+  const uint64_t key_prefix = x->prefix;
+  const int max_height = GetMaxHeight();
+  if (splice_stale_.load(std::memory_order_relaxed)) {
+    splice_stale_.store(false, std::memory_order_relaxed);
+    splice_height_ = 0;
+  }
+  // Levels the list grew into since the last insert hold no node yet.
+  for (int i = splice_height_; i < max_height; i++) {
+    prev[i] = head_;
+    next[i] = nullptr;
+  }
+  // If a level brackets key, so do the levels above it.  Keep the
+  // lowest one that does and redo the levels below it, top down.
+  int level = (splice_height_ == 0) ? max_height : 0;
+  while (level < max_height && !SpliceBrackets(key, key_prefix, level)) {
+    level++;
+  }
+  splice_height_ = max_height;
+  if (level == max_height) {
+    level = max_height - 1;
+    FindSpliceForLevel(key, key_prefix, head_, level, &prev[level],
+                       &next[level]);
+  }
+  for (int i = level - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, key_prefix, prev[i + 1], i, &prev[i], &next[i]);
+  }
+  // do not allow duplicate insertion
+  assert(next[0] == nullptr || compare_(key, next[0]->Key()) != 0);
+
+  if (height > max_height) {
+    for (int i = max_height; i < height; i++) {
+      prev[i] = head_;
+      next[i] = nullptr;
+    }
+    max_height_.store(height, std::memory_order_relaxed);
+    splice_height_ = height;
+  }
+  for (int i = 0; i < height; i++) {
+    assert(prev[i]->NoBarrier_Next(i) == next[i]);
+    x->NoBarrier_SetNext(i, next[i]);
+    prev[i]->SetNext(i, x);
+    // The new node now precedes next[i] at this level.
+    prev[i] = x;
+  }
+}
+
+template <class Comparator>
+void InlineSkipList<Comparator>::InsertConcurrently(const char* key) {
+  splice_stale_.store(true, std::memory_order_relaxed);
+  Node* x = reinterpret_cast<Node*>(const_cast<char*>(key)) - 1;
+  const int height = x->UnstashHeight();
+  const uint64_t key_prefix = compare_.Prefix(key);
+  x->prefix = key_prefix;
+
+  // Raise max_height_ first, like Insert().  Readers that see the new
+  // height before the new node simply find nullptr from head_ there.
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.compare_exchange_weak(max_height, height,
+                                          std::memory_order_relaxed)) {
+      max_height = height;
+      break;
+    }
+  }
+
+  // Find the splice at every level, top down, each level starting from
+  // the predecessor found one level up.
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int level = max_height - 1; level >= 0; level--) {
+    FindSpliceForLevel(key, key_prefix, before, level, &prev[level],
+                       &next[level]);
+    before = prev[level];
+  }
+  assert(next[0] == nullptr || compare_(key, next[0]->Key()) != 0);
+
+  // Link bottom up so that the node is reachable at level 0 before any
+  // higher level points at it.  A failed CAS means another node landed
+  // in the same gap; search forward from the old predecessor again.
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, key_prefix, prev[i], i, &prev[i], &next[i]);
+    }
+  }
+}
+
+template <class Comparator>
+bool InlineSkipList<Comparator>::Contains(const char* key) const {
+  Node* x = FindGreaterOrEqual(key, nullptr);
+  return x != nullptr && compare_(key, x->Key()) == 0;
+}
+
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_INLINESKIPLIST_H_
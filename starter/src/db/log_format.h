@@ -0,0 +1,37 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// Log format information shared by reader and writer.
+// See ../doc/log_format.md for more detail.
+
+#ifndef MINILSM_DB_LOG_FORMAT_H_
+#define MINILSM_DB_LOG_FORMAT_H_
+
+namespace minilsm {
+namespace log {
+
+enum RecordType {
+  // Zero is reserved for preallocated files
+  kZeroType = 0,
+
+  kFullType = 1,
+
+  // For fragments
+  kFirstType = 2,
+  kMiddleType = 3,
+  kLastType = 4
+};
+static const int kMaxRecordType = kLastType;
+
+static const int kBlockSize = 32768;
+
+// Header is checksum (4 bytes), length (2 bytes), type (1 byte).
+// | crc | length | type | payload |
+//   4B     2B      1B
+static const int kHeaderSize = 4 + 2 + 1;
+
+}  // namespace log
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_LOG_FORMAT_H_
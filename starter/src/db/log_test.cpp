@@ -0,0 +1,196 @@
+#include "db/log_reader.h"
+#include "db/log_writer.h"
+
+#include <string>
+#include <vector>
+
+#include "minilsm/env.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/random.h"
+
+#include <gtest/gtest.h>
+
+namespace minilsm {
+namespace log {
+
+// Construct a string of the specified length made out of the supplied
+// partial string.
+static std::string BigString(const std::string& partial_string, size_t n) {
+  std::string result;
+  while (result.size() < n) {
+    result.append(partial_string);
+  }
+  result.resize(n);
+  return result;
+}
+
+class LogTest : public testing::Test {
+ public:
+  LogTest() : reading_(false), writer_(new Writer(&dest_)),
+              reader_(new Reader(&source_, &report_, true)) {}
+  ~LogTest() override {
+    delete writer_;
+    delete reader_;
+  }
+
+  void Write(const std::string& msg) {
+    ASSERT_TRUE(!reading_) << "Write() after starting to read";
+    writer_->AddRecord(Slice(msg));
+  }
+
+  void WriteParts(const std::vector<std::string>& parts) {
+    ASSERT_TRUE(!reading_) << "Write() after starting to read";
+    std::vector<Slice> slices(parts.begin(), parts.end());
+    writer_->AddRecord(slices.data(), slices.size());
+  }
+
+  size_t WrittenBytes() const { return dest_.contents_.size(); }
+
+  std::string Read() {
+    if (!reading_) {
+      reading_ = true;
+      source_.contents_ = Slice(dest_.contents_);
+    }
+    std::string scratch;
+    Slice record;
+    if (reader_->ReadRecord(&record, &scratch)) {
+      return record.ToString();
+    } else {
+      return "EOF";
+    }
+  }
+
+  void IncrementByte(int offset, int delta) {
+    dest_.contents_[offset] += delta;
+  }
+
+  size_t DroppedBytes() const { return report_.dropped_bytes_; }
+
+ private:
+  class StringDest : public WritableFile {
+   public:
+    Status Close() override { return Status::OK(); }
+    Status Flush() override { return Status::OK(); }
+    Status Sync() override { return Status::OK(); }
+    Status Append(const Slice& slice) override {
+      contents_.append(slice.data(), slice.size());
+      return Status::OK();
+    }
+
+    std::string contents_;
+  };
+
+  class StringSource : public SequentialFile {
+   public:
+    Status Read(size_t n, Slice* result, char* scratch) override {
+      if (contents_.size() < n) {
+        n = contents_.size();
+      }
+      std::memcpy(scratch, contents_.data(), n);
+      *result = Slice(scratch, n);
+      contents_.remove_prefix(n);
+      return Status::OK();
+    }
+    Status Skip(uint64_t n) override {
+      contents_.remove_prefix(std::min<uint64_t>(n, contents_.size()));
+      return Status::OK();
+    }
+
+    Slice contents_;
+  };
+
+  class ReportCollector : public Reader::Reporter {
+   public:
+    ReportCollector() : dropped_bytes_(0) {}
+    void Corruption(size_t bytes, const Status& status) override {
+      dropped_bytes_ += bytes;
+    }
+
+    size_t dropped_bytes_;
+  };
+
+  StringDest dest_;
+  StringSource source_;
+  ReportCollector report_;
+  bool reading_;
+  Writer* writer_;
+  Reader* reader_;
+};
+
+TEST_F(LogTest, Empty) { ASSERT_EQ("EOF", Read()); }
+
+TEST_F(LogTest, ReadWrite) {
+  Write("foo");
+  Write("bar");
+  Write("");
+  Write("xxxx");
+  ASSERT_EQ("foo", Read());
+  ASSERT_EQ("bar", Read());
+  ASSERT_EQ("", Read());
+  ASSERT_EQ("xxxx", Read());
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ("EOF", Read());  // Make sure reads at eof work
+}
+
+TEST_F(LogTest, Fragmentation) {
+  Write("small");
+  Write(BigString("medium", 50000));
+  Write(BigString("large", 100000));
+  ASSERT_EQ("small", Read());
+  ASSERT_EQ(BigString("medium", 50000), Read());
+  ASSERT_EQ(BigString("large", 100000), Read());
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST_F(LogTest, GatheredParts) {
+  // Parts that straddle block boundaries, including empty ones.
+  std::vector<std::string> parts = {"header", "", BigString("a", 20000),
+                                    BigString("b", 40000), "",
+                                    BigString("c", 3)};
+  WriteParts(parts);
+  WriteParts({});
+  Write("tail");
+  std::string whole;
+  for (const std::string& part : parts) whole += part;
+  ASSERT_EQ(whole, Read());
+  ASSERT_EQ("", Read());
+  ASSERT_EQ("tail", Read());
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST_F(LogTest, MarginalTrailer) {
+  // Make a trailer that is exactly the same length as an empty record.
+  const int n = kBlockSize - 2 * kHeaderSize;
+  Write(BigString("foo", n));
+  ASSERT_EQ(kBlockSize - kHeaderSize, WrittenBytes());
+  Write("");
+  Write("bar");
+  ASSERT_EQ(BigString("foo", n), Read());
+  ASSERT_EQ("", Read());
+  ASSERT_EQ("bar", Read());
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST_F(LogTest, ChecksumMismatch) {
+  Write("foo");
+  IncrementByte(0, 10);
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(10, DroppedBytes());
+}
+
+TEST_F(LogTest, RandomRead) {
+  const int N = 500;
+  Random write_rnd(301);
+  for (int i = 0; i < N; i++) {
+    Write(BigString(std::to_string(i), write_rnd.Skewed(17)));
+  }
+  Random read_rnd(301);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(BigString(std::to_string(i), read_rnd.Skewed(17)), Read());
+  }
+  ASSERT_EQ("EOF", Read());
+}
+
+}  // namespace log
+}  // namespace minilsm
@@ -0,0 +1,158 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/log_writer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "minilsm/env.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+
+namespace minilsm {
+namespace log {
+
+// Number of payload pieces handed to WritableFile::Appendv at once.
+static const size_t kMaxFragmentParts = 64;
+
+static void InitTypeCrc(uint32_t* type_crc) {
+  for (int i = 0; i <= kMaxRecordType; i++) {
+    char t = static_cast<char>(i);
+    type_crc[i] = crc32c::Value(&t, 1);
+  }
+}
+
+Writer::Writer(WritableFile* dest) : dest_(dest), block_offset_(0) {
+  InitTypeCrc(type_crc_);
+}
+
+Writer::Writer(WritableFile* dest, uint64_t dest_length)
+    : dest_(dest), block_offset_(dest_length % kBlockSize) {
+  InitTypeCrc(type_crc_);
+}
+
+Writer::~Writer() = default;
+
+Status Writer::AddRecord(const Slice& slice) { return AddRecord(&slice, 1); }
+
+// A record that does not fit into the rest of the current block is split
+// into FIRST, MIDDLE..., LAST fragments so that a reader can always
+// resynchronize on a block boundary after corruption.
+Status Writer::AddRecord(const Slice* parts, size_t n) {
+  size_t left = 0;
+  for (size_t i = 0; i < n; i++) {
+    left += parts[i].size();
+  }
+  // Position in parts of the next byte to emit.
+  size_t part = 0;
+  size_t part_offset = 0;
+  // Pieces of the current fragment; a fragment spans at most a block.
+  std::vector<Slice> pieces;
+
+  // Fragment the record if necessary and emit it.  Note that if the
+  // record is empty, we still want to iterate once to emit a single
+  // zero-length record
+  Status s;
+  bool begin = true;
+  do {
+    const int leftover = kBlockSize - block_offset_;
+    assert(leftover >= 0);
+    if (leftover < kHeaderSize) {
+      // Switch to a new block
+      if (leftover > 0) {
+        // Fill the trailer (literal below relies on kHeaderSize being 7)
+        static_assert(kHeaderSize == 7, "");
+        dest_->Append(Slice("\x00\x00\x00\x00\x00\x00", leftover));
+      }
+      block_offset_ = 0;
+    }
+
+    // Invariant: we never leave < kHeaderSize bytes in a block.
+    assert(kBlockSize - block_offset_ - kHeaderSize >= 0);
+
+    const size_t avail = kBlockSize - block_offset_ - kHeaderSize;
+    const size_t fragment_length = (left < avail) ? left : avail;
+
+    RecordType type;
+    const bool end = (left == fragment_length);
+    if (begin && end) {
+      type = kFullType;
+    } else if (begin) {
+      type = kFirstType;
+    } else if (end) {
+      type = kLastType;
+    } else {
+      type = kMiddleType;
+    }
+
+    pieces.clear();
+    size_t needed = fragment_length;
+    while (needed > 0) {
+      const size_t take =
+          std::min(needed, parts[part].size() - part_offset);
+      if (take > 0) {
+        pieces.emplace_back(parts[part].data() + part_offset, take);
+      }
+      needed -= take;
+      part_offset += take;
+      if (part_offset == parts[part].size()) {
+        part++;
+        part_offset = 0;
+      }
+    }
+
+    s = EmitPhysicalRecord(type, pieces.data(), pieces.size(),
+                           fragment_length);
+    left -= fragment_length;
+    begin = false;
+  } while (s.ok() && left > 0);
+  return s;
+}
+
+Status Writer::EmitPhysicalRecord(RecordType t, const Slice* parts, size_t n,
+                                  size_t length) {
+  assert(length <= 0xffff);  // Must fit in two bytes
+  assert(block_offset_ + kHeaderSize + length <= kBlockSize);
+
+  // Format the header
+  char buf[kHeaderSize];
+  buf[4] = static_cast<char>(length & 0xff);
+  buf[5] = static_cast<char>(length >> 8);
+  buf[6] = static_cast<char>(t);
+
+  // Compute the crc of the record type and the payload.
+  uint32_t crc = type_crc_[t];
+  for (size_t i = 0; i < n; i++) {
+    crc = crc32c::Extend(crc, parts[i].data(), parts[i].size());
+  }
+  crc = crc32c::Mask(crc);  // Adjust for storage
+  EncodeFixed32(buf, crc);
+
+  // Write the header and the payload in one go
+  Slice iov[kMaxFragmentParts + 1];
+  Status s;
+  iov[0] = Slice(buf, kHeaderSize);
+  size_t iovcnt = 1;
+  for (size_t i = 0; s.ok() && i < n; i++) {
+    iov[iovcnt++] = parts[i];
+    if (iovcnt == kMaxFragmentParts + 1) {
+      s = dest_->Appendv(iov, iovcnt);
+      iovcnt = 0;
+    }
+  }
+  if (s.ok() && iovcnt > 0) {
+    s = dest_->Appendv(iov, iovcnt);
+  }
+  if (s.ok()) {
+    s = dest_->Flush();
+  }
+  block_offset_ += kHeaderSize + length;
+  return s;
+}
+
+}  // namespace log
+}  // namespace minilsm
@@ -0,0 +1,64 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef MINILSM_DB_LOG_WRITER_H_
+#define MINILSM_DB_LOG_WRITER_H_
+
+#include <cstdint>
+
+#include "db/log_format.h"
+#include "minilsm/slice.h"
+#include "minilsm/status.h"
+
+namespace minilsm {
+
+class WritableFile;
+
+namespace log {
+
+class Writer {
+ public:
+  // Create a writer that will append data to "*dest".
+  // "*dest" must be initially empty.
+  // "*dest" must remain live while this Writer is in use.
+  explicit Writer(WritableFile* dest);
+
+  // Create a writer that will append data to "*dest".
+  // "*dest" must have initial length "dest_length".
+  // "*dest" must remain live while this Writer is in use.
+  Writer(WritableFile* dest, uint64_t dest_length);
+
+  Writer(const Writer&) = delete;
+  Writer& operator=(const Writer&) = delete;
+
+  ~Writer();
+
+  // Append "slice" as one logical record. The data is handed to the
+  // OS but not synced; the caller decides when a Sync() is due.
+  Status AddRecord(const Slice& slice);
+
+  // Append the concatenation of parts[0..n-1] as one logical record.
+  // The parts are checksummed and written where they are, without
+  // being assembled into one buffer.
+  Status AddRecord(const Slice* parts, size_t n);
+
+ private:
+  // Emit one physical record whose payload is the concatenation of
+  // parts[0..n-1], "length" bytes in all.
+  Status EmitPhysicalRecord(RecordType type, const Slice* parts, size_t n,
+                            size_t length);
+
+  WritableFile* dest_;
+  int block_offset_;  // Current offset in block
+
+  // crc32c values for all supported record types.  These are
+  // pre-computed to reduce the overhead of computing the crc of the
+  // record type stored in the header.
+  uint32_t type_crc_[kMaxRecordType + 1];
+};
+
+}  // namespace log
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_LOG_WRITER_H_
@@ -1,8 +1,13 @@
 #include "db/memtable.h"
+
+#include <new>
+
 #include "db/dbformat.h"
 #include "minilsm/comparator.h"
 #include "minilsm/iterator.h"
 #include "util/coding.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
 
 namespace minilsm {
 
@@ -16,12 +21,114 @@ static Slice GetLengthPrefixedSlice(const char* data) {
   return Slice(p, len);
 }
 
-MemTable::MemTable(const InternalKeyComparator& comparator)
-    : comparator_(comparator), ref_(0), table_(comparator_, &arena_) {}
+// The value of an entry that starts at data.  With in-place updates the
+// value is preceded by the size of its slot, which a shorter value
+// overwriting it leaves unchanged.
+static Slice GetValue(const char* data, bool has_capacity) {
+  if (has_capacity) {
+    uint32_t capacity;
+    data = GetVarint32Ptr(data, data + 5, &capacity);
+  }
+  return GetLengthPrefixedSlice(data);
+}
+
+MemTableRep::KeyComparator::~KeyComparator() = default;
+
+MemTableRep::Iterator::~Iterator() = default;
 
-MemTable::~MemTable() { assert(ref_ == 0); }
+MemTableRep::~MemTableRep() = default;
 
-size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+MemTableRepFactory::~MemTableRepFactory() = default;
+
+char* MemTableRep::Allocate(size_t len, bool concurrent) {
+  return concurrent ? arena_->AllocateShared(len) : arena_->Allocate(len);
+}
+
+void MemTableRep::InsertConcurrently(const char* entry) {
+  // Reps that support concurrent inserts override this.
+  assert(false);
+  Insert(entry);
+}
+
+void MemTableRep::Get(const LookupKey& k, void* arg,
+                      bool (*callback)(void* arg, const char* entry)) {
+  Iterator* iter = GetIterator();
+  for (iter->Seek(k.memtable_key().data());
+       iter->Valid() && callback(arg, iter->key()); iter->Next()) {
+  }
+  delete iter;
+}
+
+static DynamicBloom* NewBloomFilter(const Options& options, Arena* arena) {
+  if (options.memtable_bloom_size_ratio <= 0) {
+    return nullptr;
+  }
+  const uint32_t bits = static_cast<uint32_t>(
+      options.write_buffer_size * options.memtable_bloom_size_ratio * 8);
+  return new (arena->AllocateAligned(sizeof(DynamicBloom)))
+      DynamicBloom(arena, bits);
+}
+
+MemTable::MemTable(const InternalKeyComparator& comparator,
+                   const Options& options)
+    : comparator_(comparator),
+      ref_(0),
+      arena_(options.arena_block_size, options.memtable_huge_page_size),
+      table_(options.memtable_factory->CreateMemTableRep(
+          comparator_, &arena_, options.prefix_extractor)),
+      write_buffer_manager_(options.write_buffer_manager),
+      bloom_filter_(NewBloomFilter(options, &arena_)),
+      num_locks_(options.inplace_update_support
+                     ? options.inplace_update_num_locks
+                     : 0),
+      locks_(num_locks_ > 0 ? new port::Mutex[num_locks_] : nullptr) {
+  if (write_buffer_manager_ != nullptr) {
+    write_buffer_manager_->AddMemTable(this);
+  }
+}
+
+MemTable::~MemTable() {
+  assert(ref_ == 0);
+  // First, as the manager may be measuring this memtable.
+  if (write_buffer_manager_ != nullptr) {
+    write_buffer_manager_->RemoveMemTable(this);
+  }
+  delete table_;
+}
+
+void MemTable::MarkImmutable() {
+  table_->MarkReadOnly();
+  if (write_buffer_manager_ != nullptr) {
+    write_buffer_manager_->MarkImmutable(this);
+  }
+}
+
+size_t MemTable::ApproximateMemoryUsage() {
+  return arena_.MemoryUsage() + table_->ApproximateMemoryUsage();
+}
+
+MemTable::KeyComparator::KeyComparator(const InternalKeyComparator& c)
+    : comparator(c),
+      bytewise(c.user_comparator() == BytewiseComparator()) {}
+
+uint64_t MemTable::KeyComparator::Prefix(const char* entry) const {
+  if (!bytewise) {
+    return 0;
+  }
+  Slice internal_key = GetLengthPrefixedSlice(entry);
+  const size_t user_key_size = internal_key.size() - 8;
+  const unsigned char* p =
+      reinterpret_cast<const unsigned char*>(internal_key.data());
+  // Zero padding keeps a key ahead of the keys it is a prefix of.
+  uint64_t prefix = 0;
+  for (size_t i = 0; i < 8; i++) {
+    prefix <<= 8;
+    if (i < user_key_size) {
+      prefix |= p[i];
+    }
+  }
+  return prefix;
+}
 
 int MemTable::KeyComparator::operator()(const char* aptr,
                                         const char* bptr) const {
@@ -44,88 +151,188 @@ static const char* EncodeKey(std::string* scratch, const Slice& target) {
 
 class MemTableIterator : public Iterator {
  public:
-  explicit MemTableIterator(MemTable::Table* table) : iter_(table) {}
+  MemTableIterator(MemTableRep* table, bool has_capacity)
+      : iter_(table->GetIterator()), has_capacity_(has_capacity) {}
 
   MemTableIterator(const MemTableIterator&) = delete;
   MemTableIterator& operator=(const MemTableIterator&) = delete;
 
-  ~MemTableIterator() override = default;
+  ~MemTableIterator() override { delete iter_; }
 
-  bool Valid() const override { return iter_.Valid(); }
-  void Seek(const Slice& k) override { iter_.Seek(EncodeKey(&tmp_, k)); }
-  void SeekToFirst() override { iter_.SeekToFirst(); }
-  void SeekToLast() override { iter_.SeekToLast(); }
-  void Next() override { iter_.Next(); }
-  void Prev() override { iter_.Prev(); }
-  Slice key() const override { return GetLengthPrefixedSlice(iter_.key()); }
+  bool Valid() const override { return iter_->Valid(); }
+  void Seek(const Slice& k) override { iter_->Seek(EncodeKey(&tmp_, k)); }
+  void SeekToFirst() override { iter_->SeekToFirst(); }
+  void SeekToLast() override { iter_->SeekToLast(); }
+  void Next() override { iter_->Next(); }
+  void Prev() override { iter_->Prev(); }
+  Slice key() const override { return GetLengthPrefixedSlice(iter_->key()); }
   // key and value are concatenated
   Slice value() const override {
-    Slice key_slice = GetLengthPrefixedSlice(iter_.key());
-    return GetLengthPrefixedSlice(key_slice.data() + key_slice.size());
+    Slice key_slice = GetLengthPrefixedSlice(iter_->key());
+    return GetValue(key_slice.data() + key_slice.size(), has_capacity_);
   }
 
   Status status() const override { return Status::OK(); }
 
  private:
-  MemTable::Table::Iterator iter_;
+  MemTableRep::Iterator* const iter_;
+  const bool has_capacity_;
   std::string tmp_;  // For passing to EncodeKey
 };
 
-Iterator* MemTable::NewIterator() { return new MemTableIterator(&table_); }
+Iterator* MemTable::NewIterator() {
+  return new MemTableIterator(table_, num_locks_ > 0);
+}
 
 void MemTable::Add(SequenceNumber seq, ValueType type, const Slice& key,
-                   const Slice& value) {
+                   const Slice& value, bool allow_concurrent) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
   //  tag          : uint64((sequence << 8) | type)
+  //  capacity     : varint32 of value.size(), if in-place updates are
+  //                 supported
   //  value_size   : varint32 of value.size()
   //  value bytes  : char[value.size()]
+  if (num_locks_ > 0 && type == kTypeValue && !allow_concurrent &&
+      UpdateInPlace(key, value)) {
+    return;
+  }
   size_t key_size = key.size();
   size_t val_size = value.size();
   size_t internal_key_size = key_size + 8;
-  const size_t encoded_len = VarintLength(internal_key_size) + 
-                             internal_key_size + VarintLength(val_size) +
-                             val_size;
-  char* buf = arena_.Allocate(encoded_len);
+  const bool has_capacity = num_locks_ > 0;
+  const size_t encoded_len =
+      VarintLength(internal_key_size) + internal_key_size +
+      (has_capacity ? VarintLength(val_size) : 0) + VarintLength(val_size) +
+      val_size;
+  // The rep may place the entry inside its own node.
+  char* buf = table_->Allocate(encoded_len, allow_concurrent);
   char* p = EncodeVarint32(buf, internal_key_size);
   std::memcpy(p, key.data(), key_size);
   p += key_size;
   EncodeFixed64(p, (seq << 8) | type);
   p += 8;
+  if (has_capacity) {
+    p = EncodeVarint32(p, val_size);
+  }
   p = EncodeVarint32(p, val_size);
   std::memcpy(p, value.data(), val_size);
   assert(p + val_size == buf + encoded_len);
-  table_.Insert(buf);
+  if (allow_concurrent) {
+    table_->InsertConcurrently(buf);
+    if (bloom_filter_ != nullptr) {
+      bloom_filter_->AddConcurrently(key);
+    }
+  } else {
+    table_->Insert(buf);
+    if (bloom_filter_ != nullptr) {
+      bloom_filter_->Add(key);
+    }
+  }
 }
                   
-bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
-  Slice memkey = key.memtable_key();
-  Table::Iterator iter(&table_);
-  iter.Seek(memkey.data());
-  if (iter.Valid()) {
-    // Check that it belongs to same user key.  We do not check the
-    // sequence number since the Seek() call above should have skipped
-    // all entries with overly large sequence numbers.
-    // seq+1 seq seq-1 ->
-    const char* entry = iter.key();
-    uint32_t key_length;  // include tag
-    const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
-    if (comparator_.comparator.user_comparator()->Compare(
-            Slice(key_ptr, key_length - 8), key.user_key()) == 0) {
-      const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
-      switch (static_cast<ValueType>(tag & 0xff)) {
-        case kTypeValue: {
-          Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
-          return true;
+namespace {
+
+struct Saver {
+  const Comparator* user_comparator;
+  Slice user_key;
+  // Held while reading a value that may be overwritten in place, or
+  // nullptr if values never are.
+  port::Mutex* lock;
+  std::string* value;
+  Status* status;
+  bool found;
+};
+
+// Called with the first entry at or after the lookup key.  The Seek
+// has skipped the entries with overly large sequence numbers, so if it
+// belongs to the same user key, it is the answer.
+bool SaveValue(void* arg, const char* entry) {
+  Saver* saver = reinterpret_cast<Saver*>(arg);
+  uint32_t key_length;  // include tag
+  const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
+  if (saver->user_comparator->Compare(Slice(key_ptr, key_length - 8),
+                                      saver->user_key) == 0) {
+    const uint64_t tag = DecodeFixed64(key_ptr + key_length - 8);
+    switch (static_cast<ValueType>(tag & 0xff)) {
+      case kTypeValue: {
+        if (saver->lock != nullptr) {
+          saver->lock->Lock();
         }
-        case kTypeDeletion:
-          *s = Status::NotFound(Slice());
-          return true;
+        Slice v = GetValue(key_ptr + key_length, saver->lock != nullptr);
+        saver->value->assign(v.data(), v.size());
+        if (saver->lock != nullptr) {
+          saver->lock->Unlock();
+        }
+        saver->found = true;
+        break;
       }
+      case kTypeDeletion:
+        *saver->status = Status::NotFound(Slice());
+        saver->found = true;
+        break;
     }
   }
   return false;
 }
-}  // minilsm
\ No newline at end of file
+
+}  // namespace
+
+bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+  if (bloom_filter_ != nullptr && !bloom_filter_->MayContain(key.user_key())) {
+    return false;
+  }
+  Saver saver;
+  saver.user_comparator = comparator_.comparator.user_comparator();
+  saver.user_key = key.user_key();
+  saver.lock = num_locks_ > 0 ? GetLock(key.user_key()) : nullptr;
+  saver.value = value;
+  saver.status = s;
+  saver.found = false;
+  table_->Get(key, &saver, SaveValue);
+  return saver.found;
+}
+
+port::Mutex* MemTable::GetLock(const Slice& user_key) {
+  return &locks_[Hash(user_key.data(), user_key.size(), 0) % num_locks_];
+}
+
+bool MemTable::UpdateInPlace(const Slice& key, const Slice& value) {
+  // Writes to the memtable are serialized, so nothing newer than the
+  // latest entry for key can show up meanwhile.
+  LookupKey lkey(key, kMaxSequenceNumber);
+  const char* entry = nullptr;
+  table_->Get(lkey, &entry, [](void* arg, const char* e) {
+    *reinterpret_cast<const char**>(arg) = e;
+    return false;
+  });
+  if (entry == nullptr) {
+    return false;
+  }
+  uint32_t key_length;  // include tag
+  const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
+  if (comparator_.comparator.user_comparator()->Compare(
+          Slice(key_ptr, key_length - 8), key) != 0 ||
+      static_cast<ValueType>(DecodeFixed64(key_ptr + key_length - 8) &
+                             0xff) != kTypeValue) {
+    return false;
+  }
+  // The entry lives in the arena, which this memtable owns.  Its slot
+  // keeps the size of the value it was added with, so a value can grow
+  // back after a shorter one.
+  const char* capacity_ptr = key_ptr + key_length;
+  uint32_t capacity;
+  char* value_ptr = const_cast<char*>(
+      GetVarint32Ptr(capacity_ptr, capacity_ptr + 5, &capacity));
+  if (value.size() > capacity) {
+    return false;
+  }
+  // The new length takes no more bytes than the capacity.
+  MutexLock l(GetLock(key));
+  char* p = EncodeVarint32(value_ptr, value.size());
+  std::memcpy(p, value.data(), value.size());
+  return true;
+}
+
+}  // minilsm
@@ -1,18 +1,23 @@
 #ifndef MINILSM_DB_MEMTABLE_H_
 #define MINILSM_DB_MEMTABLE_H_
 
+#include <memory>
 #include <string>
 
 #include "db/dbformat.h"
-#include "db/skiplist.h"
 #include "minilsm/db.h"
+#include "minilsm/memtablerep.h"
+#include "minilsm/write_buffer_manager.h"
+#include "port/port.h"
 #include "util/arena.h"
+#include "util/dynamic_bloom.h"
 
 namespace minilsm {
 
 class MemTable {
 public:
-  explicit MemTable(const InternalKeyComparator& comparator);
+  // The representation is created by options.memtable_factory.
+  MemTable(const InternalKeyComparator& comparator, const Options& options);
   MemTable(const MemTable&) = delete;
   MemTable& operator=(const MemTable&) = delete;
   
@@ -25,6 +30,10 @@ public:
     }
   }
 
+  // Called once nothing more will be added, when the memtable is
+  // queued for flushing.
+  void MarkImmutable();
+
   // Returns an estimate of the number of bytes of data in use by this
   // data structure. It is safe to call when MemTable is being modified.
   size_t ApproximateMemoryUsage();
@@ -40,8 +49,12 @@ public:
   // Add an entry into memtable that maps key to value at the
   // specified sequence number and with the specified type.
   // Typically value will be empty if type==kTypeDeletion.
+  // If allow_concurrent is true, other threads may be calling Add with
+  // allow_concurrent set on this memtable at the same time.
+  // If options.inplace_update_support, a value may instead overwrite the
+  // latest value of key in place, which keeps its sequence number.
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
-           const Slice& value);
+           const Slice& value, bool allow_concurrent = false);
 
   // If memtable contains a value for key, store it in *value and return true.
   // If memtable contains a deletion for key, store a NotFound() error
@@ -52,20 +65,38 @@ public:
 private:
   friend class MemTableIterator;
 
-  struct KeyComparator {
+  struct KeyComparator : public MemTableRep::KeyComparator {
     const InternalKeyComparator comparator;
-    explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) {}
-    int operator()(const char* a, const char* b) const;
+    // Whether the user keys are ordered bytewise, so that their first
+    // bytes make a usable prefix.
+    const bool bytewise;
+    explicit KeyComparator(const InternalKeyComparator& c);
+    int operator()(const char* a, const char* b) const override;
+    // The first 8 bytes of the user key, big-endian and zero-padded, if
+    // bytewise.  Otherwise 0, and entries are always compared in full.
+    uint64_t Prefix(const char* entry) const override;
   };
 
-  typedef SkipList<const char*, KeyComparator> Table;
-
   ~MemTable();  // only Unref() should be used to delete it
 
+  // Overwrite the value of the latest version of key in place, if it is
+  // a value whose slot holds value.  Returns whether it was.
+  bool UpdateInPlace(const Slice& key, const Slice& value);
+
+  // The lock that guards in-place updates of the values of user_key.
+  port::Mutex* GetLock(const Slice& user_key);
+
   KeyComparator comparator_;
   int ref_;
   Arena arena_;
-  Table table_;
+  MemTableRep* const table_;
+  // Counts this memtable's memory, or nullptr.
+  WriteBufferManager* const write_buffer_manager_;
+  // Of the user keys added, or nullptr if disabled.  Lives in arena_.
+  DynamicBloom* const bloom_filter_;
+  // Guard values overwritten in place, if options.inplace_update_support.
+  const size_t num_locks_;
+  std::unique_ptr<port::Mutex[]> locks_;
 };
 }
 #endif  // MINILSM_DB_MEMTABLE_H_
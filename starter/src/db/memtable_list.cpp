@@ -0,0 +1,48 @@
+#include "db/memtable_list.h"
+
+#include <cassert>
+
+#include "db/memtable.h"
+
+namespace minilsm {
+
+MemTableList::~MemTableList() {
+  for (const Entry& e : memlist_) {
+    e.mem->Unref();
+  }
+}
+
+void MemTableList::Add(MemTable* mem, uint64_t next_log_number) {
+  assert(memlist_.empty() ||
+         memlist_.back().next_log_number < next_log_number);
+  mem->MarkImmutable();
+  memlist_.push_back(Entry{mem, next_log_number});
+}
+
+void MemTableList::Ref(std::vector<MemTable*>* mems) const {
+  mems->clear();
+  for (auto it = memlist_.rbegin(); it != memlist_.rend(); ++it) {
+    it->mem->Ref();
+    mems->push_back(it->mem);
+  }
+}
+
+void MemTableList::PickMemTablesToFlush(std::vector<MemTable*>* mems,
+                                        uint64_t* log_number) const {
+  assert(!memlist_.empty());
+  mems->clear();
+  for (const Entry& e : memlist_) {
+    mems->push_back(e.mem);
+  }
+  *log_number = memlist_.back().next_log_number;
+}
+
+void MemTableList::RemoveFlushed(size_t n) {
+  assert(n <= memlist_.size());
+  for (size_t i = 0; i < n; i++) {
+    memlist_.front().mem->Unref();
+    memlist_.pop_front();
+  }
+}
+
+}  // namespace minilsm
@@ -0,0 +1,60 @@
+#ifndef MINILSM_DB_MEMTABLE_LIST_H_
+#define MINILSM_DB_MEMTABLE_LIST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace minilsm {
+
+class MemTable;
+
+// The immutable memtables of a DB that are waiting to be flushed,
+// oldest first.  Each one remembers the number of the log file that
+// was started when it was frozen: once it and every older memtable are
+// in tables, all logs before that one are obsolete.
+//
+// MemTableList is not thread-safe; DBImpl guards it with its mutex.
+class MemTableList {
+public:
+  MemTableList() = default;
+  MemTableList(const MemTableList&) = delete;
+  MemTableList& operator=(const MemTableList&) = delete;
+  ~MemTableList();
+
+  bool empty() const { return memlist_.empty(); }
+  int size() const { return static_cast<int>(memlist_.size()); }
+
+  // Mark *mem immutable and queue it for flushing.  The list takes over
+  // the caller's reference.  "next_log_number" is the log that receives
+  // the writes following the last one in *mem.
+  void Add(MemTable* mem, uint64_t next_log_number);
+
+  // Store every queued memtable in *mems, newest first, and take a
+  // reference on each so they outlive a concurrent flush.  The caller
+  // must Unref() them when done.
+  void Ref(std::vector<MemTable*>* mems) const;
+
+  // Store the memtables that are currently queued in *mems, oldest
+  // first, and the log number that becomes the DB's log number once
+  // they are flushed.  The list keeps its references until
+  // RemoveFlushed() is called.
+  void PickMemTablesToFlush(std::vector<MemTable*>* mems,
+                            uint64_t* log_number) const;
+
+  // Drop the n oldest memtables after they were written to a table.
+  void RemoveFlushed(size_t n);
+
+private:
+  struct Entry {
+    MemTable* mem;
+    uint64_t next_log_number;
+  };
+
+  std::deque<Entry> memlist_;
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_MEMTABLE_LIST_H_
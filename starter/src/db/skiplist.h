@@ -4,7 +4,9 @@
 #include <cassert>
 #include <cstdlib>
 #include <iostream> // for Print
+#include <functional>  // for std::hash
 #include <string>   // for Print
+#include <thread>
 #include <type_traits>    // is_same
 #include <unordered_map>  // for Print
 #include <vector>   // for Print
@@ -28,6 +30,12 @@ public:
   // Requires: nothing that compares equal to key is in the list
   void Insert(const Key& key);
 
+  // Like Insert, but safe to call from several threads at once.  Links
+  // are published with compare-and-swap, and the node is allocated
+  // through the arena's thread-safe path.  Must not run concurrently
+  // with Insert.
+  void InsertConcurrently(const Key& key);
+
   bool Contains(const Key& key) const;
   void Print() const;
 
@@ -61,8 +69,8 @@ private:
   inline int GetMaxHeight() const {
     return max_height_.load(std::memory_order_relaxed);
   }
-  Node* NewNode(const Key& key, int height);
-  int RandomHeight();
+  Node* NewNode(const Key& key, int height, bool concurrent = false);
+  int RandomHeight(Random* rnd);
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
   // Return true if key is greater than the data stored in "n"
   bool KeyIsAfterNode(const Key& key, Node* n) const;
@@ -74,6 +82,11 @@ private:
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting from "before", which must sort before key, find the
+  // neighbours of key at the given level: *out_prev < key <= *out_next.
+  void FindSpliceForLevel(const Key& key, Node* before, int level,
+                          Node** out_prev, Node** out_next) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -81,12 +94,27 @@ private:
   // Return the last node in the list.
   // Return head_ if list is empty.
   Node* FindLast() const;
+  // Whether key falls between splice_prev_[level] and
+  // splice_next_[level].
+  bool SpliceBrackets(const Key& key, int level) const;
+
   Comparator const compare_;  // Immutable after construction
   Arena* const arena_;
   Node* const head_;
 
   std::atomic<int> max_height_;
   Random rnd_;  // RW only by Insert()
+
+  // Where Insert() linked the last key, RW only by Insert(): at every
+  // level below splice_height_, splice_next_[i] directly follows
+  // splice_prev_[i], and the last key falls between them.  The next
+  // insert starts its search from the lowest level that brackets its
+  // key, so ascending inserts skip the descent from head_.
+  Node* splice_prev_[kMaxHeight];
+  Node* splice_next_[kMaxHeight];
+  int splice_height_;
+  // Set by InsertConcurrently(), whose inserts the splice misses.
+  std::atomic<bool> splice_stale_;
 };
   
 template <typename Key, class Comparator>
@@ -110,6 +138,13 @@ struct SkipList<Key, Comparator>::Node {
     assert(n >= 0);
     next_[n].store(x, std::memory_order_relaxed);
   }
+
+  // Replace the link at level n with x iff it still points at expected.
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].compare_exchange_strong(expected, x,
+                                            std::memory_order_release);
+  }
 private:
   // size is equal to the node height. next_[0] is the lowest level link
   std::atomic<Node*> next_[1];
@@ -117,11 +152,12 @@ private:
 
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::NewNode(
-    const Key& key, int height) {
+    const Key& key, int height, bool concurrent) {
   // number of Node* should be equal to height, but sizeof(node) has
   // includeed one Node*, so height - 1 here
-  char* const node_memory = arena_->AllocateAligned(
-      sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1));
+  const size_t bytes = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+  char* const node_memory = concurrent ? arena_->AllocateAlignedShared(bytes)
+                                       : arena_->AllocateAligned(bytes);
   return new (node_memory) Node(key);
 }
 
@@ -176,11 +212,11 @@ inline void SkipList<Key, Comparator>::Iterator::SeekToLast() {
 }
 
 template <typename Key, class Comparator>
-int SkipList<Key, Comparator>::RandomHeight() {
+int SkipList<Key, Comparator>::RandomHeight(Random* rnd) {
   static const unsigned int kBranching = 4;
   // probability = 1 in 4
   int height = 1;
-  while (height < kMaxHeight && rnd_.OneIn(kBranching)) {
+  while (height < kMaxHeight && rnd->OneIn(kBranching)) {
     height++;
   }
   assert(height > 0);
@@ -214,6 +250,22 @@ SkipList<Key, Comparator>::FindGreaterOrEqual(const Key& key,
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FindSpliceForLevel(const Key& key,
+                                                   Node* before, int level,
+                                                   Node** out_prev,
+                                                   Node** out_next) const {
+  while (true) {
+    Node* next = before->Next(level);
+    if (!KeyIsAfterNode(key, next)) {
+      *out_prev = before;
+      *out_next = next;
+      return;
+    }
+    before = next;
+  }
+}
+
 // reverse logic of FindGreater
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node*
@@ -260,30 +312,117 @@ SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena)
       arena_(arena),
       head_(NewNode(0 /* any key will do*/, kMaxHeight)),
       max_height_(1),
-      rnd_(0xdeadbeef) {
+      rnd_(0xdeadbeef),
+      splice_height_(0),
+      splice_stale_(false) {
   for (int i = 0; i < kMaxHeight; i++) {
     head_->SetNext(i, nullptr);
   }
 }
 
+template <typename Key, class Comparator>
+bool SkipList<Key, Comparator>::SpliceBrackets(const Key& key,
+                                               int level) const {
+  return (splice_prev_[level] == head_ ||
+          compare_(splice_prev_[level]->key, key) < 0) &&
+         (splice_next_[level] == nullptr ||
+          compare_(key, splice_next_[level]->key) < 0);
+}
+
 template <typename Key, class Comparator>
 void SkipList<Key, Comparator>::Insert(const Key& key) {
-  Node* prev[kMaxHeight];
-  Node* x = FindGreaterOrEqual(key, prev);
+  Node** const prev = splice_prev_;
+  Node** const next = splice_next_;
+  const int max_height = GetMaxHeight();
+  if (splice_stale_.load(std::memory_order_relaxed)) {
+    splice_stale_.store(false, std::memory_order_relaxed);
+    splice_height_ = 0;
+  }
+  // Levels the list grew into since the last insert hold no node yet.
+  for (int i = splice_height_; i < max_height; i++) {
+    prev[i] = head_;
+    next[i] = nullptr;
+  }
+  // If a level brackets key, so do the levels above it.  Keep the
+  // lowest one that does and redo the levels below it, top down.
+  int level = (splice_height_ == 0) ? max_height : 0;
+  while (level < max_height && !SpliceBrackets(key, level)) {
+    level++;
+  }
+  splice_height_ = max_height;
+  if (level == max_height) {
+    level = max_height - 1;
+    FindSpliceForLevel(key, head_, level, &prev[level], &next[level]);
+  }
+  for (int i = level - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, prev[i + 1], i, &prev[i], &next[i]);
+  }
   // do not allow duplicate insertion
-  assert(x == nullptr || !Equal(key, x->key));
-  int height = RandomHeight();
-  if (height > GetMaxHeight()) {
-    for (int i = GetMaxHeight(); i < height; i++) {
+  assert(next[0] == nullptr || !Equal(key, next[0]->key));
+
+  int height = RandomHeight(&rnd_);
+  if (height > max_height) {
+    for (int i = max_height; i < height; i++) {
       prev[i] = head_;
+      next[i] = nullptr;
     }
     // consider why we can set new height before set new node
     max_height_.store(height, std::memory_order_relaxed);
+    splice_height_ = height;
   }
-  x = NewNode(key, height);
+  Node* x = NewNode(key, height);
   for (int i = 0; i < height; i++) {
-    x->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
+    assert(prev[i]->NoBarrier_Next(i) == next[i]);
+    x->NoBarrier_SetNext(i, next[i]);
     prev[i]->SetNext(i, x);
+    // The new node now precedes next[i] at this level.
+    prev[i] = x;
+  }
+}
+
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::InsertConcurrently(const Key& key) {
+  splice_stale_.store(true, std::memory_order_relaxed);
+  // rnd_ belongs to Insert(); concurrent inserters each draw heights
+  // from their own generator.
+  static thread_local Random rnd(static_cast<uint32_t>(
+      std::hash<std::thread::id>()(std::this_thread::get_id())));
+  const int height = RandomHeight(&rnd);
+
+  // Raise max_height_ first, like Insert().  Readers that see the new
+  // height before the new node simply find nullptr from head_ there.
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.compare_exchange_weak(max_height, height,
+                                          std::memory_order_relaxed)) {
+      max_height = height;
+      break;
+    }
+  }
+
+  // Find the splice at every level, top down, each level starting from
+  // the predecessor found one level up.
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int level = max_height - 1; level >= 0; level--) {
+    FindSpliceForLevel(key, before, level, &prev[level], &next[level]);
+    before = prev[level];
+  }
+  assert(next[0] == nullptr || !Equal(key, next[0]->key));
+
+  // Link bottom up so that the node is reachable at level 0 before any
+  // higher level points at it.  A failed CAS means another node landed
+  // in the same gap; search forward from the old predecessor again.
+  Node* x = NewNode(key, height, true);
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+    }
   }
 }
 
@@ -1,5 +1,12 @@
 #include "db/skiplist.h"
 
+#include "db/inlineskiplist.h"
+#include "util/coding.h"
+
+#include <set>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 /**
@@ -83,4 +90,240 @@ TEST(SkipTest, GrowAndPrint) {
     list.Print();
   }
 }
-}  // namespace minilsm
\ No newline at end of file
+
+TEST(SkipTest, InsertConcurrently) {
+  Arena arena;
+  TestComparator cmp;
+  SkipList<Key, TestComparator> list(cmp, &arena);
+
+  // Threads insert interleaved keys so that they keep landing in the
+  // same gaps and racing on the same links.
+  const int kThreads = 8;
+  const int kPerThread = 5000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&list, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        list.InsertConcurrently(static_cast<Key>(i) * kThreads + t);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  SkipList<Key, TestComparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key k = 0; k < static_cast<Key>(kThreads * kPerThread); k++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+  for (Key k = 0; k < static_cast<Key>(kThreads * kPerThread); k += 97) {
+    ASSERT_TRUE(list.Contains(k));
+  }
+}
+TEST(SkipTest, SpliceReuse) {
+  Arena arena;
+  TestComparator cmp;
+  SkipList<Key, TestComparator> list(cmp, &arena);
+
+  // Ascending and descending runs, random keys, and concurrent inserts
+  // that the splice of Insert does not see, in between.
+  std::set<Key> keys;
+  Random rnd(301);
+  for (int round = 0; round < 4; round++) {
+    const Key base = round * 1000000;
+    for (Key k = base; k < base + 2000; k++) {
+      list.Insert(k);
+      keys.insert(k);
+    }
+    for (Key k = base + 500000; k > base + 498000; k--) {
+      list.Insert(k);
+      keys.insert(k);
+    }
+    for (int i = 0; i < 2000; i++) {
+      const Key k = rnd.Next();
+      if (keys.insert(k).second) {
+        if (i % 3 == 0) {
+          list.InsertConcurrently(k);
+        } else {
+          list.Insert(k);
+        }
+      }
+    }
+  }
+
+  SkipList<Key, TestComparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key k : keys) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
+// Inline keys are Keys stored big-endian, so that a key is its own
+// prefix.  With use_prefix unset every key has the same prefix and
+// searches fall back to full comparisons.
+struct InlineTestComparator {
+  bool use_prefix;
+
+  static Key Decode(const char* key) {
+    Key k = 0;
+    for (int i = 0; i < 8; i++) {
+      k = (k << 8) | static_cast<unsigned char>(key[i]);
+    }
+    return k;
+  }
+  int operator()(const char* a, const char* b) const {
+    return TestComparator()(Decode(a), Decode(b));
+  }
+  uint64_t Prefix(const char* key) const {
+    return use_prefix ? Decode(key) : 0;
+  }
+};
+
+static void EncodeInlineKey(char* buf, Key k) {
+  for (int i = 7; i >= 0; i--) {
+    buf[i] = static_cast<char>(k & 0xff);
+    k >>= 8;
+  }
+}
+
+TEST(InlineSkipTest, InsertAndLookup) {
+  for (bool use_prefix : {true, false}) {
+    Arena arena;
+    InlineTestComparator cmp{use_prefix};
+    InlineSkipList<InlineTestComparator> list(cmp, &arena);
+    char buf[8];
+
+    const int N = 2000;
+    const int R = 5000;
+    Random rnd(1000);
+    std::set<Key> keys;
+    for (int i = 0; i < N; i++) {
+      Key key = rnd.Next() % R;
+      if (keys.insert(key).second) {
+        char* entry = list.AllocateKey(8);
+        EncodeInlineKey(entry, key);
+        list.Insert(entry);
+      }
+    }
+
+    for (int i = 0; i < R; i++) {
+      EncodeInlineKey(buf, i);
+      ASSERT_EQ(keys.count(i), list.Contains(buf) ? 1U : 0U);
+    }
+
+    // Forward and backward iteration
+    InlineSkipList<InlineTestComparator>::Iterator iter(&list);
+    ASSERT_TRUE(!iter.Valid());
+    iter.SeekToFirst();
+    for (Key k : keys) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(k, InlineTestComparator::Decode(iter.key()));
+      iter.Next();
+    }
+    ASSERT_TRUE(!iter.Valid());
+    iter.SeekToLast();
+    for (auto it = keys.rbegin(); it != keys.rend(); ++it) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(*it, InlineTestComparator::Decode(iter.key()));
+      iter.Prev();
+    }
+    ASSERT_TRUE(!iter.Valid());
+
+    // Seek lands on the first key >= target
+    for (int i = 0; i < R; i += 7) {
+      EncodeInlineKey(buf, i);
+      iter.Seek(buf);
+      auto expected = keys.lower_bound(i);
+      if (expected == keys.end()) {
+        ASSERT_TRUE(!iter.Valid());
+      } else {
+        ASSERT_TRUE(iter.Valid());
+        ASSERT_EQ(*expected, InlineTestComparator::Decode(iter.key()));
+      }
+    }
+  }
+}
+
+TEST(InlineSkipTest, SpliceReuse) {
+  Arena arena;
+  InlineTestComparator cmp{true};
+  InlineSkipList<InlineTestComparator> list(cmp, &arena);
+  auto insert = [&list](Key k, bool concurrent) {
+    char* entry = list.AllocateKey(8, concurrent);
+    EncodeInlineKey(entry, k);
+    if (concurrent) {
+      list.InsertConcurrently(entry);
+    } else {
+      list.Insert(entry);
+    }
+  };
+
+  std::set<Key> keys;
+  Random rnd(301);
+  for (int round = 0; round < 4; round++) {
+    const Key base = round * 1000000;
+    for (Key k = base; k < base + 2000; k++) {
+      insert(k, false);
+      keys.insert(k);
+    }
+    for (Key k = base + 500000; k > base + 498000; k--) {
+      insert(k, false);
+      keys.insert(k);
+    }
+    for (int i = 0; i < 2000; i++) {
+      const Key k = rnd.Next();
+      if (keys.insert(k).second) {
+        insert(k, i % 3 == 0);
+      }
+    }
+  }
+
+  InlineSkipList<InlineTestComparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key k : keys) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, InlineTestComparator::Decode(iter.key()));
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
+TEST(InlineSkipTest, InsertConcurrently) {
+  Arena arena;
+  InlineTestComparator cmp{true};
+  InlineSkipList<InlineTestComparator> list(cmp, &arena);
+
+  const int kThreads = 8;
+  const int kPerThread = 5000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&list, t]() {
+      for (int i = 0; i < kPerThread; i++) {
+        char* entry = list.AllocateKey(8, true);
+        EncodeInlineKey(entry, static_cast<Key>(i) * kThreads + t);
+        list.InsertConcurrently(entry);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  InlineSkipList<InlineTestComparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key k = 0; k < static_cast<Key>(kThreads * kPerThread); k++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, InlineTestComparator::Decode(iter.key()));
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
+}  // namespace minilsm
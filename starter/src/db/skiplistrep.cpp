@@ -0,0 +1,70 @@
+#include "db/dbformat.h"
+#include "db/inlineskiplist.h"
+#include "minilsm/memtablerep.h"
+
+namespace minilsm {
+
+namespace {
+
+class SkipListRep : public MemTableRep {
+  typedef InlineSkipList<const MemTableRep::KeyComparator&> List;
+
+ public:
+  SkipListRep(const MemTableRep::KeyComparator& compare, Arena* arena)
+      : MemTableRep(arena), skip_list_(compare, arena) {}
+
+  char* Allocate(size_t len, bool concurrent) override {
+    return skip_list_.AllocateKey(len, concurrent);
+  }
+
+  void Insert(const char* entry) override { skip_list_.Insert(entry); }
+
+  void InsertConcurrently(const char* entry) override {
+    skip_list_.InsertConcurrently(entry);
+  }
+
+  bool Contains(const char* key) const override {
+    return skip_list_.Contains(key);
+  }
+
+  void Get(const LookupKey& k, void* arg,
+           bool (*callback)(void* arg, const char* entry)) override {
+    List::Iterator iter(&skip_list_);
+    for (iter.Seek(k.memtable_key().data());
+         iter.Valid() && callback(arg, iter.key()); iter.Next()) {
+    }
+  }
+
+  class Iterator : public MemTableRep::Iterator {
+   public:
+    explicit Iterator(const List* list) : iter_(list) {}
+
+    bool Valid() const override { return iter_.Valid(); }
+    const char* key() const override { return iter_.key(); }
+    void Next() override { iter_.Next(); }
+    void Prev() override { iter_.Prev(); }
+    void Seek(const char* target) override { iter_.Seek(target); }
+    void SeekToFirst() override { iter_.SeekToFirst(); }
+    void SeekToLast() override { iter_.SeekToLast(); }
+
+   private:
+    List::Iterator iter_;
+  };
+
+  MemTableRep::Iterator* GetIterator() override {
+    return new Iterator(&skip_list_);
+  }
+
+ private:
+  List skip_list_;
+};
+
+}  // namespace
+
+MemTableRep* SkipListFactory::CreateMemTableRep(
+    const MemTableRep::KeyComparator& compare, Arena* arena,
+    const SliceTransform* prefix_extractor) const {
+  return new SkipListRep(compare, arena);
+}
+
+}  // namespace minilsm
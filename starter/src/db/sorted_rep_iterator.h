@@ -0,0 +1,78 @@
+#ifndef MINILSM_DB_SORTED_REP_ITERATOR_H_
+#define MINILSM_DB_SORTED_REP_ITERATOR_H_
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "minilsm/memtablerep.h"
+
+namespace minilsm {
+
+// Iterates over a vector of memtable entries sorted by compare, for
+// reps that do not keep their entries in order.  The vector is either
+// owned, taken from the caller and sorted up front, or borrowed, in
+// which case it must already be sorted and must not change while the
+// iterator is in use.
+class SortedRepIterator : public MemTableRep::Iterator {
+ public:
+  // Take the contents of *entries and sort them.
+  SortedRepIterator(std::vector<const char*>* entries,
+                    const MemTableRep::KeyComparator& compare)
+      : compare_(compare), entries_(&owned_), pos_(0) {
+    owned_.swap(*entries);
+    std::sort(owned_.begin(), owned_.end(), Less{&compare_});
+  }
+
+  // Iterate over *sorted, which must outlive the iterator.
+  SortedRepIterator(const std::vector<const char*>* sorted,
+                    const MemTableRep::KeyComparator& compare)
+      : compare_(compare), entries_(sorted), pos_(0) {}
+
+  bool Valid() const override { return pos_ < entries_->size(); }
+
+  const char* key() const override {
+    assert(Valid());
+    return (*entries_)[pos_];
+  }
+
+  void Next() override {
+    assert(Valid());
+    pos_++;
+  }
+
+  void Prev() override {
+    assert(Valid());
+    pos_ = (pos_ == 0) ? entries_->size() : pos_ - 1;
+  }
+
+  void Seek(const char* target) override {
+    pos_ = std::lower_bound(entries_->begin(), entries_->end(), target,
+                            Less{&compare_}) -
+           entries_->begin();
+  }
+
+  void SeekToFirst() override { pos_ = 0; }
+
+  void SeekToLast() override {
+    pos_ = entries_->empty() ? 0 : entries_->size() - 1;
+  }
+
+  // Orders entries for std::sort and friends.
+  struct Less {
+    const MemTableRep::KeyComparator* compare;
+    bool operator()(const char* a, const char* b) const {
+      return (*compare)(a, b) < 0;
+    }
+  };
+
+ private:
+  const MemTableRep::KeyComparator& compare_;
+  std::vector<const char*> owned_;
+  const std::vector<const char*>* const entries_;
+  size_t pos_;
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_SORTED_REP_ITERATOR_H_
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "db/sorted_rep_iterator.h"
+#include "minilsm/memtablerep.h"
+
+namespace minilsm {
+
+namespace {
+
+// Sort *v, splitting the work over up to one thread per core: each
+// sorts a run of at least kMinRun entries, then runs are merged
+// pairwise, the merges of a round also in parallel.
+void ParallelSort(std::vector<const char*>* v,
+                  const MemTableRep::KeyComparator& compare) {
+  static const size_t kMinRun = 4096;
+  const SortedRepIterator::Less less{&compare};
+  const size_t max_runs =
+      std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  const size_t runs = std::min(max_runs, v->size() / kMinRun);
+  if (runs <= 1) {
+    std::sort(v->begin(), v->end(), less);
+    return;
+  }
+
+  // Run i is [bounds[i], bounds[i + 1]).
+  std::vector<size_t> bounds(runs + 1);
+  for (size_t i = 0; i <= runs; i++) {
+    bounds[i] = v->size() * i / runs;
+  }
+  auto begin = v->begin();
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < runs; i++) {
+    threads.emplace_back([=] {
+      std::sort(begin + bounds[i], begin + bounds[i + 1], less);
+    });
+  }
+  std::sort(begin + bounds[0], begin + bounds[1], less);
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  for (size_t width = 1; width < runs; width *= 2) {
+    threads.clear();
+    for (size_t i = 0; i + width < runs; i += 2 * width) {
+      const size_t mid = bounds[i + width];
+      const size_t end = bounds[std::min(i + 2 * width, runs)];
+      threads.emplace_back([=] {
+        std::inplace_merge(begin + bounds[i], begin + mid, begin + end, less);
+      });
+    }
+    for (std::thread& t : threads) {
+      t.join();
+    }
+  }
+}
+
+class VectorRep : public MemTableRep {
+ public:
+  VectorRep(const MemTableRep::KeyComparator& compare, Arena* arena,
+            size_t reserve)
+      : MemTableRep(arena),
+        compare_(compare),
+        read_only_(false),
+        sorted_(false),
+        memory_usage_(0) {
+    entries_.reserve(reserve);
+    memory_usage_.store(entries_.capacity() * sizeof(const char*),
+                        std::memory_order_relaxed);
+  }
+
+  void Insert(const char* entry) override {
+    std::lock_guard<std::mutex> l(mu_);
+    assert(!read_only_);
+    entries_.push_back(entry);
+    memory_usage_.store(entries_.capacity() * sizeof(const char*),
+                        std::memory_order_relaxed);
+  }
+
+  void MarkReadOnly() override {
+    std::lock_guard<std::mutex> l(mu_);
+    read_only_ = true;
+  }
+
+  bool Contains(const char* key) const override {
+    std::lock_guard<std::mutex> l(mu_);
+    for (const char* entry : entries_) {
+      if (compare_(entry, key) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t ApproximateMemoryUsage() override {
+    return memory_usage_.load(std::memory_order_relaxed);
+  }
+
+  MemTableRep::Iterator* GetIterator() override {
+    std::lock_guard<std::mutex> l(mu_);
+    if (read_only_) {
+      // Sort once, in place; the entries no longer change.
+      if (!sorted_) {
+        ParallelSort(&entries_, compare_);
+        sorted_ = true;
+      }
+      return new SortedRepIterator(
+          static_cast<const std::vector<const char*>*>(&entries_), compare_);
+    }
+    std::vector<const char*> copy(entries_);
+    return new SortedRepIterator(&copy, compare_);
+  }
+
+ private:
+  const MemTableRep::KeyComparator& compare_;
+
+  // Guards entries_ until it is sorted.  Iterators over the sorted
+  // entries read them without it.
+  mutable std::mutex mu_;
+  std::vector<const char*> entries_;
+  bool read_only_;
+  bool sorted_;
+  std::atomic<size_t> memory_usage_;
+};
+
+class VectorRepFactory : public MemTableRepFactory {
+ public:
+  explicit VectorRepFactory(size_t reserve) : reserve_(reserve) {}
+
+  MemTableRep* CreateMemTableRep(
+      const MemTableRep::KeyComparator& compare, Arena* arena,
+      const SliceTransform* prefix_extractor) const override {
+    return new VectorRep(compare, arena, reserve_);
+  }
+
+  const char* Name() const override { return "VectorRepFactory"; }
+
+ private:
+  const size_t reserve_;
+};
+
+}  // namespace
+
+MemTableRepFactory* NewVectorRepFactory(size_t reserve) {
+  return new VectorRepFactory(reserve);
+}
+
+}  // namespace minilsm
@@ -11,31 +11,62 @@
 #ifndef MINILSM_DB_VERSION_SET_H_
 #define MINILSM_DB_VERSION_SET_H_
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <string>
 #include <vector>
 
 #include "db/dbformat.h"
-// #include "db/version_edit.h"
+#include "db/version_edit.h"
 #include "minilsm/options.h"
 #include "port/port.h"
 
 namespace minilsm {
 
+namespace log {
+class Writer;
+}
+
 class Iterator;
 class MemTable;
+class TableCache;
 class Version;
 class VersionSet;
+class WritableFile;
+
+// Return the smallest index i such that files[i]->largest >= key.
+// Return files.size() if there is no such file.
+// REQUIRES: "files" contains a sorted list of non-overlapping files.
+int FindFile(const InternalKeyComparator& icmp,
+             const std::vector<FileMetaData*>& files, const Slice& key);
 
 class Version {
 public:
+  // Append to *iters a sequence of iterators that will
+  // yield the contents of this Version when merged together.
+  // REQUIRES: This version has been saved (see VersionSet::SaveTo)
+  void AddIterators(const ReadOptions&, std::vector<Iterator*>* iters);
+
+  // Lookup the value for key.  If found, store it in *val and
+  // return OK.  Else return a non-OK status.
+  // REQUIRES: lock is not held
+  Status Get(const ReadOptions&, const LookupKey& key, std::string* val);
+
   // Reference count management (so Versions do not disappear out from
   // under live iterators)
   void Ref();
   void Unref();
+
+  int NumFiles(int level) const { return files_[level].size(); }
+
+  // Return a human readable string that describes this version's contents.
+  std::string DebugString() const;
 private:
   friend class VersionSet;
+
+  class LevelFileNumIterator;
+
   explicit Version(VersionSet* vset)
       : vset_(vset),
         next_(this),
@@ -45,31 +76,103 @@ private:
   Version(const Version&) = delete;
   Version& operator=(const Version&) = delete;
 
+  ~Version();
+
+  Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
+
   VersionSet* vset_;  // VersionSet to which this Versions belongs
   Version* next_;  // next version in linked list
   Version* prev_;  // previous version in linked list
   int refs_;  // Number of live references to this Version.
+
+  // List of files per level. Files in level 0 are kept in the order
+  // they were flushed, oldest first.
+  std::vector<FileMetaData*> files_[config::kNumLevels];
 };
 
 class VersionSet {
 public:
-  VersionSet(const std::string& dbname, const Options* options);
+  VersionSet(const std::string& dbname, const Options* options,
+             TableCache* table_cache, const InternalKeyComparator* cmp);
+  VersionSet(const VersionSet&) = delete;
+  VersionSet& operator=(const VersionSet&) = delete;
+  ~VersionSet();
+
+  // Apply *edit to the current version to form a new descriptor that
+  // is both saved to persistent state and installed as the new
+  // current version.  Will release *mu while actually writing to the file.
+  // REQUIRES: *mu is held on entry.
+  // REQUIRES: no other thread concurrently calls LogAndApply()
+  Status LogAndApply(VersionEdit* edit, port::Mutex* mu);
+
+  // Recover the last saved descriptor from persistent storage.
+  Status Recover();
+
   Version* current() const { return current_; }
-  uint64_t LastSequence() const { return last_sequence_; }
+
+  // Return the current manifest file number
+  uint64_t ManifestFileNumber() const { return manifest_file_number_; }
+
+  // Allocate and return a new file number
+  uint64_t NewFileNumber() { return next_file_number_++; }
+
+  // Mark the specified file number as used.
+  void MarkFileNumberUsed(uint64_t number) {
+    if (next_file_number_ <= number) {
+      next_file_number_ = number + 1;
+    }
+  }
+
+  // Return the number of Table files at the specified level.
+  int NumLevelFiles(int level) const;
+
+  // Estimate of the bytes compactions have to rewrite to bring every
+  // level under its size target: all of level 0 once it has enough
+  // files to be compacted, plus the excess of each larger level.
+  uint64_t EstimatedPendingCompactionBytes() const;
+
+  // The last sequence number visible to readers.  Unlike the rest of
+  // VersionSet this may be read and published without holding the DB
+  // mutex, since the write path publishes it from the memtable stage.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
   void SetLastSequence(uint64_t seq) { 
     // has to be ascending
-    assert(seq >= last_sequence_);
-    last_sequence_ = seq; 
+    assert(seq >= LastSequence());
+    last_sequence_.store(seq, std::memory_order_release);
   }
+
+  // Return the current log file number.  Logs older than this have been
+  // flushed to tables and can be deleted.
+  uint64_t LogNumber() const { return log_number_; }
+
+  // Add all files listed in any live version to *live.
+  // May also mutate some internal state.
+  void AddLiveFiles(std::set<uint64_t>* live);
 private:
+  class Builder;
+
   friend class Version;
 
   void AppendVersion(Version* v);
+
+  Status WriteSnapshot(log::Writer* log);
   
+  Env* const env_;
   const std::string dbname_;
   const Options* const options_;
+  TableCache* const table_cache_;
+  const InternalKeyComparator icmp_;
+
+  uint64_t next_file_number_;
+  uint64_t manifest_file_number_;
+  std::atomic<uint64_t> last_sequence_;
+  uint64_t log_number_;
 
-  uint64_t last_sequence_;
+  // Opened lazily
+  WritableFile* descriptor_file_;
+  log::Writer* descriptor_log_;
 
   Version dummy_versions_;  // Head of circular doubly-linked list of versions
   Version* current_;  // == dummy_versions_.prev_
@@ -77,4 +180,4 @@ private:
 
 }
 
-#endif  // MINILSM_DB_VERSION_SET_H_
\ No newline at end of file
+#endif  // MINILSM_DB_VERSION_SET_H_
@@ -20,7 +20,7 @@
 namespace minilsm {
 
 // WriteBatch header has an 8-byte sequence number followed by a 4-byte count.
-static const size_t kHeader = 12;
+static const size_t kHeader = WriteBatchInternal::kHeaderSize;
 
 WriteBatch::WriteBatch() { Clear(); }
 
@@ -115,27 +115,36 @@ class MemTableInserter : public WriteBatch::Handler {
 public:
   SequenceNumber sequence_;
   MemTable* mem_;
+  bool concurrent_;
 
   void Put(const Slice& key, const Slice& value) override {
-    mem_->Add(sequence_, kTypeValue, key, value);
+    mem_->Add(sequence_, kTypeValue, key, value, concurrent_);
     sequence_++;
   }
 
   void Delete(const Slice& key) override {
-    mem_->Add(sequence_, kTypeDeletion, key, Slice());
+    mem_->Add(sequence_, kTypeDeletion, key, Slice(), concurrent_);
     sequence_++;
   }
 };
 }  // namespace
 
-Status WriteBatchInternal::InsertInto(const WriteBatch* b, MemTable* memtable) {
+Status WriteBatchInternal::InsertInto(const WriteBatch* b, MemTable* memtable,
+                                      bool concurrent_memtable_writes) {
   MemTableInserter inserter;
   inserter.sequence_ = WriteBatchInternal::Sequence(b);
   inserter.mem_ = memtable;
+  inserter.concurrent_ = concurrent_memtable_writes;
   // handle every record in the write batch
   return b->Iterate(&inserter);
 }
 
+void WriteBatchInternal::EncodeHeader(char* dst, SequenceNumber seq,
+                                      int count) {
+  EncodeFixed64(dst, seq);
+  EncodeFixed32(dst + 8, count);
+}
+
 void WriteBatchInternal::SetContents(WriteBatch* b, const Slice& contents) {
   assert(contents.size() >= kHeader);
   b->rep_.assign(contents.data(), contents.size());
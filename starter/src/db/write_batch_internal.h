@@ -16,6 +16,9 @@ class MemTable;
 // WriteBatch that we don't want in the public WriteBatch interface.
 class WriteBatchInternal {
  public:
+  // Size of the sequence number and count that prefix the records.
+  static const size_t kHeaderSize = 12;
+
   // Return the number of entries in the batch.
   static int Count(const WriteBatch* batch);
 
@@ -35,7 +38,21 @@ class WriteBatchInternal {
 
   static void SetContents(WriteBatch* batch, const Slice& contents);
 
-  static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
+  // Return the records of the batch, without the header.
+  static Slice Records(const WriteBatch* batch) {
+    return Slice(batch->rep_.data() + kHeaderSize,
+                 batch->rep_.size() - kHeaderSize);
+  }
+
+  // Store a header for a batch of "count" entries starting at "seq" in
+  // dst[0..kHeaderSize-1].  Followed by the records of one or more
+  // batches, it forms the contents of a batch.
+  static void EncodeHeader(char* dst, SequenceNumber seq, int count);
+
+  // If concurrent_memtable_writes is true, other threads may be
+  // inserting other batches into memtable at the same time.
+  static Status InsertInto(const WriteBatch* batch, MemTable* memtable,
+                           bool concurrent_memtable_writes = false);
 
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
@@ -0,0 +1,416 @@
+#include "minilsm/write_batch_with_index.h"
+
+#include <cassert>
+#include <cstdint>
+
+#include "db/dbformat.h"
+#include "db/skiplist.h"
+#include "db/write_batch_internal.h"
+#include "minilsm/db.h"
+#include "util/arena.h"
+#include "util/coding.h"
+
+namespace minilsm {
+
+namespace {
+
+// Index entry for one record of the batch.  Entries point into rep_ by
+// offset, since rep_ moves as it grows.
+struct IndexEntry {
+  size_t offset;      // Of the record's tag
+  size_t key_offset;  // Of the key bytes
+  size_t key_size;
+  // Set only on entries built for a lookup, which carry the key itself.
+  const Slice* search_key;
+};
+
+// Orders entries by key, and the updates of a key newest first.  A
+// lookup entry sorts before every update of its key.
+class IndexComparator {
+ public:
+  IndexComparator(const Comparator* cmp, const WriteBatch* batch)
+      : comparator(cmp), batch_(batch) {}
+
+  Slice Key(const IndexEntry* entry) const {
+    if (entry->search_key != nullptr) {
+      return *entry->search_key;
+    }
+    return Slice(WriteBatchInternal::Contents(batch_).data() +
+                     entry->key_offset,
+                 entry->key_size);
+  }
+
+  int operator()(const IndexEntry* a, const IndexEntry* b) const {
+    int r = comparator->Compare(Key(a), Key(b));
+    if (r == 0) {
+      if (a->offset > b->offset) {
+        r = -1;
+      } else if (a->offset < b->offset) {
+        r = +1;
+      }
+    }
+    return r;
+  }
+
+  const Comparator* const comparator;
+
+ private:
+  const WriteBatch* const batch_;
+};
+
+typedef SkipList<const IndexEntry*, IndexComparator> Index;
+
+// Iterates over the latest update of each key in the index.
+class IndexIterator {
+ public:
+  IndexIterator(const Index* index, const IndexComparator* cmp,
+                const WriteBatch* batch)
+      : iter_(index), cmp_(cmp), batch_(batch) {}
+
+  bool Valid() const { return iter_.Valid(); }
+  Slice key() const { return cmp_->Key(iter_.key()); }
+
+  ValueType type() const {
+    return static_cast<ValueType>(Record()[0]);
+  }
+
+  Slice value() const {
+    assert(type() == kTypeValue);
+    const IndexEntry* entry = iter_.key();
+    Slice input = Record();
+    input.remove_prefix(entry->key_offset + entry->key_size - entry->offset);
+    Slice value;
+    GetLengthPrefixedSlice(&input, &value);
+    return value;
+  }
+
+  void SeekToFirst() { iter_.SeekToFirst(); }
+
+  void SeekToLast() {
+    iter_.SeekToLast();
+    SeekToNewest();
+  }
+
+  void Seek(const Slice& target) {
+    IndexEntry lookup = {SIZE_MAX, 0, 0, &target};
+    iter_.Seek(&lookup);
+  }
+
+  void Next() {
+    // Skip the older updates of the current key.
+    const Slice current = key();
+    do {
+      iter_.Next();
+    } while (iter_.Valid() && cmp_->comparator->Compare(key(), current) == 0);
+  }
+
+  void Prev() {
+    // Lands on the oldest update of the previous key.
+    iter_.Prev();
+    SeekToNewest();
+  }
+
+ private:
+  // Move from any update of a key to its newest one.
+  void SeekToNewest() {
+    if (iter_.Valid()) {
+      const Slice current = key();
+      Seek(current);
+    }
+  }
+
+  Slice Record() const {
+    const Slice contents = WriteBatchInternal::Contents(batch_);
+    const size_t offset = iter_.key()->offset;
+    return Slice(contents.data() + offset, contents.size() - offset);
+  }
+
+  Index::Iterator iter_;
+  const IndexComparator* const cmp_;
+  const WriteBatch* const batch_;
+};
+
+// Merges a DB iterator (the base) with the index of a batch (the
+// delta).  On equal keys the delta wins; deletions in the delta hide
+// the base entry and are not returned themselves.
+class BaseDeltaIterator : public Iterator {
+ public:
+  BaseDeltaIterator(Iterator* base, IndexIterator* delta,
+                    const Comparator* comparator)
+      : forward_(true),
+        current_at_base_(true),
+        equal_keys_(false),
+        base_(base),
+        delta_(delta),
+        comparator_(comparator) {}
+
+  ~BaseDeltaIterator() override {
+    delete base_;
+    delete delta_;
+  }
+
+  bool Valid() const override {
+    return current_at_base_ ? base_->Valid() : delta_->Valid();
+  }
+
+  void SeekToFirst() override {
+    forward_ = true;
+    base_->SeekToFirst();
+    delta_->SeekToFirst();
+    UpdateCurrent();
+  }
+
+  void SeekToLast() override {
+    forward_ = false;
+    base_->SeekToLast();
+    delta_->SeekToLast();
+    UpdateCurrent();
+  }
+
+  void Seek(const Slice& target) override {
+    forward_ = true;
+    base_->Seek(target);
+    delta_->Seek(target);
+    UpdateCurrent();
+  }
+
+  void Next() override {
+    assert(Valid());
+    if (!forward_) {
+      // Both sides are positioned at or before the current entry; move
+      // the one that is not at it past it.
+      forward_ = true;
+      equal_keys_ = false;
+      if (!base_->Valid()) {
+        base_->SeekToFirst();
+      } else if (!delta_->Valid()) {
+        delta_->SeekToFirst();
+      } else if (current_at_base_) {
+        AdvanceDelta();
+      } else {
+        AdvanceBase();
+      }
+      if (base_->Valid() && delta_->Valid() &&
+          comparator_->Compare(delta_->key(), base_->key()) == 0) {
+        equal_keys_ = true;
+      }
+    }
+    Advance();
+  }
+
+  void Prev() override {
+    assert(Valid());
+    if (forward_) {
+      forward_ = false;
+      equal_keys_ = false;
+      if (!base_->Valid()) {
+        base_->SeekToLast();
+      } else if (!delta_->Valid()) {
+        delta_->SeekToLast();
+      } else if (current_at_base_) {
+        AdvanceDelta();
+      } else {
+        AdvanceBase();
+      }
+      if (base_->Valid() && delta_->Valid() &&
+          comparator_->Compare(delta_->key(), base_->key()) == 0) {
+        equal_keys_ = true;
+      }
+    }
+    Advance();
+  }
+
+  Slice key() const override {
+    return current_at_base_ ? base_->key() : delta_->key();
+  }
+
+  Slice value() const override {
+    return current_at_base_ ? base_->value() : delta_->value();
+  }
+
+  Status status() const override { return base_->status(); }
+
+ private:
+  void AdvanceDelta() {
+    if (forward_) {
+      delta_->Next();
+    } else {
+      delta_->Prev();
+    }
+  }
+
+  void AdvanceBase() {
+    if (forward_) {
+      base_->Next();
+    } else {
+      base_->Prev();
+    }
+  }
+
+  // Move past the current entry, on both sides if they are at the same
+  // key.
+  void Advance() {
+    if (equal_keys_) {
+      AdvanceBase();
+      AdvanceDelta();
+    } else if (current_at_base_) {
+      AdvanceBase();
+    } else {
+      AdvanceDelta();
+    }
+    UpdateCurrent();
+  }
+
+  // Pick the side whose entry comes first in the current direction,
+  // skipping deletions in the delta along with what they hide.
+  void UpdateCurrent() {
+    while (true) {
+      equal_keys_ = false;
+      if (!delta_->Valid()) {
+        current_at_base_ = true;
+        return;
+      }
+      int compare = -1;
+      if (base_->Valid()) {
+        compare = comparator_->Compare(delta_->key(), base_->key());
+        if (!forward_) {
+          compare = -compare;
+        }
+      }
+      if (compare > 0) {
+        current_at_base_ = true;
+        return;
+      }
+      equal_keys_ = (compare == 0);
+      if (delta_->type() != kTypeDeletion) {
+        current_at_base_ = false;
+        return;
+      }
+      AdvanceDelta();
+      if (equal_keys_) {
+        AdvanceBase();
+      }
+    }
+  }
+
+  bool forward_;
+  bool current_at_base_;
+  bool equal_keys_;
+  Iterator* const base_;
+  IndexIterator* const delta_;
+  const Comparator* const comparator_;
+};
+
+}  // namespace
+
+struct WriteBatchWithIndex::Rep {
+  explicit Rep(const Comparator* comparator)
+      : index_comparator(comparator, &batch),
+        arena(new Arena),
+        index(new Index(index_comparator, arena)) {}
+
+  ~Rep() {
+    delete index;
+    delete arena;
+  }
+
+  // Index the record that was just appended to batch at offset.
+  void AddEntry(size_t offset) {
+    const Slice contents = WriteBatchInternal::Contents(&batch);
+    Slice input(contents.data() + offset + 1,  // Skip the tag
+                contents.size() - offset - 1);
+    Slice key;
+    GetLengthPrefixedSlice(&input, &key);
+    IndexEntry* entry = reinterpret_cast<IndexEntry*>(
+        arena->AllocateAligned(sizeof(IndexEntry)));
+    entry->offset = offset;
+    entry->key_offset = key.data() - contents.data();
+    entry->key_size = key.size();
+    entry->search_key = nullptr;
+    index->Insert(entry);
+  }
+
+  enum LookupResult { kFound, kDeleted, kNotInBatch };
+
+  // Find the latest update of key, storing its value in *value if it is
+  // a Put.
+  LookupResult Lookup(const Slice& key, std::string* value) const {
+    IndexIterator iter(index, &index_comparator, &batch);
+    iter.Seek(key);
+    if (!iter.Valid() ||
+        index_comparator.comparator->Compare(iter.key(), key) != 0) {
+      return kNotInBatch;
+    }
+    if (iter.type() == kTypeDeletion) {
+      return kDeleted;
+    }
+    const Slice v = iter.value();
+    value->assign(v.data(), v.size());
+    return kFound;
+  }
+
+  WriteBatch batch;
+  const IndexComparator index_comparator;
+  Arena* arena;
+  Index* index;
+};
+
+WriteBatchWithIndex::WriteBatchWithIndex(const Comparator* comparator)
+    : rep_(new Rep(comparator)) {}
+
+WriteBatchWithIndex::~WriteBatchWithIndex() { delete rep_; }
+
+void WriteBatchWithIndex::Put(const Slice& key, const Slice& value) {
+  const size_t offset = WriteBatchInternal::ByteSize(&rep_->batch);
+  rep_->batch.Put(key, value);
+  rep_->AddEntry(offset);
+}
+
+void WriteBatchWithIndex::Delete(const Slice& key) {
+  const size_t offset = WriteBatchInternal::ByteSize(&rep_->batch);
+  rep_->batch.Delete(key);
+  rep_->AddEntry(offset);
+}
+
+void WriteBatchWithIndex::Clear() {
+  rep_->batch.Clear();
+  delete rep_->index;
+  delete rep_->arena;
+  rep_->arena = new Arena;
+  rep_->index = new Index(rep_->index_comparator, rep_->arena);
+}
+
+WriteBatch* WriteBatchWithIndex::GetWriteBatch() { return &rep_->batch; }
+
+Status WriteBatchWithIndex::GetFromBatch(const Slice& key,
+                                         std::string* value) const {
+  if (rep_->Lookup(key, value) == Rep::kFound) {
+    return Status::OK();
+  }
+  return Status::NotFound(Slice());
+}
+
+Status WriteBatchWithIndex::GetFromBatchAndDB(DB* db,
+                                              const ReadOptions& options,
+                                              const Slice& key,
+                                              std::string* value) const {
+  switch (rep_->Lookup(key, value)) {
+    case Rep::kFound:
+      return Status::OK();
+    case Rep::kDeleted:
+      return Status::NotFound(Slice());
+    case Rep::kNotInBatch:
+      break;
+  }
+  return db->Get(options, key, value);
+}
+
+Iterator* WriteBatchWithIndex::NewIteratorWithBase(
+    Iterator* base_iterator) const {
+  return new BaseDeltaIterator(
+      base_iterator,
+      new IndexIterator(rep_->index, &rep_->index_comparator, &rep_->batch),
+      rep_->index_comparator.comparator);
+}
+
+}  // namespace minilsm
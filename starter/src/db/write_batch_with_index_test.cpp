@@ -0,0 +1,171 @@
+#include "minilsm/write_batch_with_index.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "minilsm/db.h"
+#include "minilsm/env.h"
+#include "util/random.h"
+
+#include <gtest/gtest.h>
+
+namespace minilsm {
+
+class WriteBatchWithIndexTest : public testing::Test {
+ public:
+  WriteBatchWithIndexTest() : env_(Env::Default()), db_(nullptr) {
+    dbname_ = testing::TempDir() + "minilsm_wbwi_test";
+    DestroyFiles();
+    Options options;
+    options.create_if_missing = true;
+    EXPECT_TRUE(DB::Open(options, dbname_, &db_).ok());
+  }
+  ~WriteBatchWithIndexTest() override {
+    delete db_;
+    DestroyFiles();
+  }
+
+  std::string Get(const WriteBatchWithIndex& batch, const std::string& k) {
+    std::string result;
+    Status s = batch.GetFromBatchAndDB(db_, ReadOptions(), k, &result);
+    if (s.IsNotFound()) {
+      result = "NOT_FOUND";
+    } else if (!s.ok()) {
+      result = s.ToString();
+    }
+    return result;
+  }
+
+  Env* env_;
+  std::string dbname_;
+  DB* db_;
+
+ private:
+  void DestroyFiles() {
+    std::vector<std::string> children;
+    if (env_->GetChildren(dbname_, &children).ok()) {
+      for (const std::string& child : children) {
+        env_->DeleteFile(dbname_ + "/" + child);
+      }
+    }
+  }
+};
+
+TEST_F(WriteBatchWithIndexTest, GetFromBatch) {
+  WriteBatchWithIndex batch;
+  std::string value;
+  ASSERT_TRUE(batch.GetFromBatch("a", &value).IsNotFound());
+
+  batch.Put("a", "v1");
+  batch.Put("b", "v2");
+  batch.Put("a", "v3");
+  batch.Delete("b");
+  ASSERT_TRUE(batch.GetFromBatch("a", &value).ok());
+  ASSERT_EQ("v3", value);
+  ASSERT_TRUE(batch.GetFromBatch("b", &value).IsNotFound());
+  ASSERT_TRUE(batch.GetFromBatch("c", &value).IsNotFound());
+
+  batch.Clear();
+  ASSERT_TRUE(batch.GetFromBatch("a", &value).IsNotFound());
+  batch.Put("a", "v4");
+  ASSERT_TRUE(batch.GetFromBatch("a", &value).ok());
+  ASSERT_EQ("v4", value);
+}
+
+TEST_F(WriteBatchWithIndexTest, GetFromBatchAndDB) {
+  ASSERT_TRUE(db_->Put(WriteOptions(), "a", "db_a").ok());
+  ASSERT_TRUE(db_->Put(WriteOptions(), "b", "db_b").ok());
+  ASSERT_TRUE(db_->Put(WriteOptions(), "c", "db_c").ok());
+
+  WriteBatchWithIndex batch;
+  batch.Put("a", "batch_a");
+  batch.Delete("b");
+  batch.Put("d", "batch_d");
+  ASSERT_EQ("batch_a", Get(batch, "a"));
+  ASSERT_EQ("NOT_FOUND", Get(batch, "b"));
+  ASSERT_EQ("db_c", Get(batch, "c"));
+  ASSERT_EQ("batch_d", Get(batch, "d"));
+  ASSERT_EQ("NOT_FOUND", Get(batch, "e"));
+
+  // Once written, the DB agrees.
+  ASSERT_TRUE(db_->Write(WriteOptions(), batch.GetWriteBatch()).ok());
+  std::string value;
+  ASSERT_TRUE(db_->Get(ReadOptions(), "a", &value).ok());
+  ASSERT_EQ("batch_a", value);
+  ASSERT_TRUE(db_->Get(ReadOptions(), "b", &value).IsNotFound());
+}
+
+TEST_F(WriteBatchWithIndexTest, IteratorWithBase) {
+  // Random updates to the DB and then to the batch, checked against a
+  // model of their combination in both directions.
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  WriteBatchWithIndex batch;
+  for (int i = 0; i < 500; i++) {
+    const std::string key = "k" + std::to_string(rnd.Uniform(200));
+    const std::string value = "db" + std::to_string(i);
+    ASSERT_TRUE(db_->Put(WriteOptions(), key, value).ok());
+    model[key] = value;
+  }
+  for (int i = 0; i < 300; i++) {
+    const std::string key = "k" + std::to_string(rnd.Uniform(250));
+    if (rnd.OneIn(3)) {
+      batch.Delete(key);
+      model.erase(key);
+    } else {
+      const std::string value = "batch" + std::to_string(i);
+      batch.Put(key, value);
+      model[key] = value;
+    }
+  }
+
+  Iterator* iter = batch.NewIteratorWithBase(db_->NewIterator(ReadOptions()));
+  auto expected = model.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+    ASSERT_TRUE(expected != model.end());
+    ASSERT_EQ(expected->first, iter->key().ToString());
+    ASSERT_EQ(expected->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(expected == model.end());
+
+  auto rexpected = model.rbegin();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rexpected) {
+    ASSERT_TRUE(rexpected != model.rend());
+    ASSERT_EQ(rexpected->first, iter->key().ToString());
+    ASSERT_EQ(rexpected->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(rexpected == model.rend());
+
+  // Seek, then wander back and forth.
+  for (int i = 0; i < 100; i++) {
+    const std::string target = "k" + std::to_string(rnd.Uniform(260));
+    iter->Seek(target);
+    auto pos = model.lower_bound(target);
+    for (int step = 0; step < 10; step++) {
+      if (pos == model.end()) {
+        ASSERT_FALSE(iter->Valid());
+        break;
+      }
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(pos->first, iter->key().ToString());
+      ASSERT_EQ(pos->second, iter->value().ToString());
+      if (rnd.OneIn(2)) {
+        iter->Next();
+        ++pos;
+      } else {
+        if (pos == model.begin()) {
+          iter->Prev();
+          ASSERT_FALSE(iter->Valid());
+          break;
+        }
+        iter->Prev();
+        --pos;
+      }
+    }
+  }
+  ASSERT_TRUE(iter->status().ok());
+  delete iter;
+}
+
+}  // namespace minilsm
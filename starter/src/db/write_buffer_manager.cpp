@@ -0,0 +1,84 @@
+#include "minilsm/write_buffer_manager.h"
+
+#include <cassert>
+#include <utility>
+
+#include "db/memtable.h"
+
+namespace minilsm {
+
+WriteBufferManager::WriteBufferManager(size_t buffer_size)
+    : buffer_size_(buffer_size) {}
+
+WriteBufferManager::~WriteBufferManager() = default;
+
+size_t WriteBufferManager::memory_usage() const {
+  std::lock_guard<std::mutex> l(mu_);
+  size_t usage = 0;
+  for (const auto& m : memtables_) {
+    usage += m.first->ApproximateMemoryUsage();
+  }
+  return usage;
+}
+
+void WriteBufferManager::AddMemTable(MemTable* mem) {
+  std::lock_guard<std::mutex> l(mu_);
+  const bool inserted = memtables_.emplace(mem, Entry()).second;
+  assert(inserted);
+  (void)inserted;
+}
+
+void WriteBufferManager::RemoveMemTable(MemTable* mem) {
+  std::lock_guard<std::mutex> l(mu_);
+  memtables_.erase(mem);
+}
+
+void WriteBufferManager::SetActive(MemTable* mem,
+                                   std::function<void()> flush) {
+  std::lock_guard<std::mutex> l(mu_);
+  auto it = memtables_.find(mem);
+  assert(it != memtables_.end());
+  it->second.flush = std::move(flush);
+  it->second.flush_requested = false;
+}
+
+void WriteBufferManager::MarkImmutable(MemTable* mem) {
+  std::lock_guard<std::mutex> l(mu_);
+  auto it = memtables_.find(mem);
+  if (it != memtables_.end()) {
+    it->second.flush = nullptr;
+  }
+}
+
+void WriteBufferManager::MaybeFlush() {
+  std::lock_guard<std::mutex> l(mu_);
+  size_t total = 0;
+  // Memory of the active memtables that no flush has been asked for.
+  size_t mutable_usage = 0;
+  Entry* largest = nullptr;
+  size_t largest_usage = 0;
+  for (auto& m : memtables_) {
+    const size_t usage = m.first->ApproximateMemoryUsage();
+    total += usage;
+    Entry& e = m.second;
+    if (e.flush && !e.flush_requested) {
+      mutable_usage += usage;
+      if (largest == nullptr || usage > largest_usage) {
+        largest = &e;
+        largest_usage = usage;
+      }
+    }
+  }
+  // Flush once the memtables still being written take up most of the
+  // budget, or the budget is exceeded and at least half of it would be
+  // freed by flushing them rather than by the flushes under way.
+  const bool should_flush =
+      mutable_usage > buffer_size_ - buffer_size_ / 8 ||
+      (total >= buffer_size_ && mutable_usage >= buffer_size_ / 2);
+  if (should_flush && largest != nullptr) {
+    largest->flush_requested = true;
+    largest->flush();
+  }
+}
+
+}  // namespace minilsm
@@ -0,0 +1,69 @@
+#include "db/write_controller.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace minilsm {
+
+namespace {
+
+constexpr uint64_t kMicrosPerSecond = 1000000;
+
+// The bucket is refilled at most this often, so that a stream of tiny
+// writes does not read the clock for every one of them.
+constexpr uint64_t kMicrosPerRefill = 1000;
+
+}  // namespace
+
+WriteController::WriteController(uint64_t delayed_write_rate)
+    : delayed_write_rate_(std::max<uint64_t>(delayed_write_rate, 1)),
+      stopped_(false),
+      delayed_(false),
+      next_refill_time_(0),
+      credit_in_bytes_(0) {}
+
+void WriteController::SetState(bool stopped, bool delayed) {
+  if (delayed && !NeedsDelay()) {
+    // Start from an empty bucket so the slowdown applies at once.
+    next_refill_time_ = 0;
+    credit_in_bytes_ = 0;
+  }
+  stopped_.store(stopped, std::memory_order_relaxed);
+  delayed_.store(delayed, std::memory_order_relaxed);
+}
+
+uint64_t WriteController::GetDelay(uint64_t now_micros, uint64_t num_bytes) {
+  if (!NeedsDelay()) {
+    return 0;
+  }
+  if (credit_in_bytes_ >= num_bytes) {
+    credit_in_bytes_ -= num_bytes;
+    return 0;
+  }
+
+  if (next_refill_time_ == 0) {
+    next_refill_time_ = now_micros;
+  }
+  if (next_refill_time_ <= now_micros) {
+    // Credit the time since the last refill, plus one refill period
+    // paid in advance.
+    const uint64_t elapsed = now_micros - next_refill_time_ + kMicrosPerRefill;
+    credit_in_bytes_ += elapsed * delayed_write_rate_ / kMicrosPerSecond;
+    next_refill_time_ = now_micros + kMicrosPerRefill;
+    if (credit_in_bytes_ >= num_bytes) {
+      credit_in_bytes_ -= num_bytes;
+      return 0;
+    }
+  }
+
+  // Borrow the missing bytes from the future: the next refill moves
+  // back by the time they take at the delayed rate.
+  const uint64_t bytes_over_budget = num_bytes - credit_in_bytes_;
+  credit_in_bytes_ = 0;
+  next_refill_time_ += bytes_over_budget * kMicrosPerSecond /
+                       delayed_write_rate_;
+  assert(next_refill_time_ > now_micros);
+  return std::max(next_refill_time_ - now_micros, kMicrosPerRefill);
+}
+
+}  // namespace minilsm
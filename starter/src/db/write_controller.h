@@ -0,0 +1,49 @@
+#ifndef MINILSM_DB_WRITE_CONTROLLER_H_
+#define MINILSM_DB_WRITE_CONTROLLER_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace minilsm {
+
+// WriteController holds the write stall state of a DB: writes run
+// freely, are delayed to a fixed rate, or are stopped until background
+// work catches up.  The DB recomputes the state whenever the amount of
+// unflushed or uncompacted data changes.
+//
+// Delays come from a token bucket that refills at the delayed write
+// rate, so a burst is smoothed out into a steady stream instead of
+// running into a stop.
+//
+// SetState and GetDelay require external synchronization (the DB
+// mutex); IsStopped and NeedsDelay may be called without it.
+class WriteController {
+public:
+  explicit WriteController(uint64_t delayed_write_rate);
+
+  WriteController(const WriteController&) = delete;
+  WriteController& operator=(const WriteController&) = delete;
+
+  void SetState(bool stopped, bool delayed);
+
+  bool IsStopped() const { return stopped_.load(std::memory_order_relaxed); }
+  bool NeedsDelay() const { return delayed_.load(std::memory_order_relaxed); }
+
+  // Return how many microseconds a write of num_bytes issued at
+  // now_micros has to wait, and take the bytes out of the bucket.
+  // Returns 0 unless writes are delayed.
+  uint64_t GetDelay(uint64_t now_micros, uint64_t num_bytes);
+
+private:
+  const uint64_t delayed_write_rate_;  // Bytes per second
+  std::atomic<bool> stopped_;
+  std::atomic<bool> delayed_;
+
+  // Token bucket state.
+  uint64_t next_refill_time_;  // 0 if the bucket has not been used
+  uint64_t credit_in_bytes_;
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_WRITE_CONTROLLER_H_
@@ -0,0 +1,429 @@
+#include "db/write_thread.h"
+
+#include <cassert>
+#include <chrono>
+#include <utility>
+#include <thread>
+
+#include "db/write_batch_internal.h"
+#include "port/port.h"
+
+namespace minilsm {
+
+namespace {
+
+// Number of state checks spent spinning before a waiter starts yielding.
+// A hand-off between two running threads normally lands within these.
+constexpr int kSpinChecks = 200;
+
+// Upper bound on time spent yielding before blocking.
+constexpr std::chrono::microseconds kMaxYieldTime(100);
+
+// A yield that takes longer than this means other threads wanted the
+// CPU; a few of them in a row and the waiter blocks instead.
+constexpr std::chrono::microseconds kSlowYieldTime(3);
+constexpr int kMaxSlowYields = 3;
+
+// Every outcome moves yield_credit_ by this much, and the credit decays
+// by 1/1024 of itself, so it tracks roughly the last thousand waits.
+constexpr int32_t kYieldCreditStep = 1 << 17;
+
+}  // namespace
+
+WriteThread::WriteThread(bool allow_concurrent_memtable_write,
+                         std::function<void(Writer*)> schedule_detached_leader)
+    : allow_concurrent_memtable_write_(allow_concurrent_memtable_write),
+      schedule_detached_leader_(std::move(schedule_detached_leader)),
+      newest_writer_(nullptr),
+      newest_memtable_writer_(nullptr),
+      yield_credit_(0) {}
+
+uint8_t WriteThread::BlockingAwaitState(Writer* w, uint8_t goal_mask) {
+  uint8_t state = w->state.load(std::memory_order_acquire);
+  if ((state & goal_mask) == 0 &&
+      w->state.compare_exchange_strong(state, STATE_LOCKED_WAITING)) {
+    // The writer that moves us out of STATE_LOCKED_WAITING does so under
+    // state_mutex and then notifies.
+    std::unique_lock<std::mutex> guard(w->state_mutex);
+    w->state_cv.wait(guard, [w] {
+      return w->state.load(std::memory_order_relaxed) != STATE_LOCKED_WAITING;
+    });
+    state = w->state.load(std::memory_order_relaxed);
+  }
+  assert((state & goal_mask) != 0);
+  return state;
+}
+
+uint8_t WriteThread::AwaitState(Writer* w, uint8_t goal_mask) {
+  uint8_t state;
+  for (int i = 0; i < kSpinChecks; i++) {
+    state = w->state.load(std::memory_order_acquire);
+    if ((state & goal_mask) != 0) {
+      return state;
+    }
+    port::AsmVolatilePause();
+  }
+
+  // Yielding only pays off when the hand-off usually comes within a
+  // few scheduler rounds; otherwise it just burns CPU before blocking.
+  if (yield_credit_.load(std::memory_order_relaxed) >= 0) {
+    const auto start = std::chrono::steady_clock::now();
+    auto last = start;
+    int slow_yields = 0;
+    bool success = false;
+    while (true) {
+      std::this_thread::yield();
+      state = w->state.load(std::memory_order_acquire);
+      if ((state & goal_mask) != 0) {
+        success = true;
+        break;
+      }
+      const auto now = std::chrono::steady_clock::now();
+      if (now - start > kMaxYieldTime) {
+        break;
+      }
+      if (now - last > kSlowYieldTime && ++slow_yields >= kMaxSlowYields) {
+        break;
+      }
+      last = now;
+    }
+    // Races between updates only lose a sample.
+    int32_t credit = yield_credit_.load(std::memory_order_relaxed);
+    credit = credit - credit / 1024 +
+             (success ? kYieldCreditStep : -kYieldCreditStep);
+    yield_credit_.store(credit, std::memory_order_relaxed);
+    if (success) {
+      return state;
+    }
+  }
+
+  return BlockingAwaitState(w, goal_mask);
+}
+
+void WriteThread::SetState(Writer* w, uint8_t new_state) {
+  uint8_t state = w->state.load(std::memory_order_acquire);
+  if (state == STATE_LOCKED_WAITING ||
+      !w->state.compare_exchange_strong(state, new_state)) {
+    assert(state == STATE_LOCKED_WAITING);
+    std::lock_guard<std::mutex> guard(w->state_mutex);
+    assert(w->state.load(std::memory_order_relaxed) != new_state);
+    w->state.store(new_state, std::memory_order_relaxed);
+    w->state_cv.notify_one();
+  }
+}
+
+void WriteThread::CompleteWriter(Writer* w) {
+  if (w->detached) {
+    w->callback(w->status);
+    delete w;
+  } else {
+    SetState(w, STATE_COMPLETED);
+  }
+}
+
+bool WriteThread::LinkOne(Writer* w, std::atomic<Writer*>* newest_writer) {
+  Writer* writers = newest_writer->load(std::memory_order_relaxed);
+  while (true) {
+    w->link_older = writers;
+    if (newest_writer->compare_exchange_weak(writers, w)) {
+      return (writers == nullptr);
+    }
+  }
+}
+
+bool WriteThread::LinkGroup(WriteGroup& group,
+                            std::atomic<Writer*>* newest_writer) {
+  Writer* leader = group.leader;
+  Writer* last_writer = group.last_writer;
+  // Clear link_newer so that CreateMissingNewerLinks() rebuilds all of
+  // them for the new list.
+  Writer* w = last_writer;
+  while (true) {
+    w->link_newer = nullptr;
+    w->write_group = nullptr;
+    if (w == leader) {
+      break;
+    }
+    w = w->link_older;
+  }
+  Writer* newest = newest_writer->load(std::memory_order_relaxed);
+  while (true) {
+    leader->link_older = newest;
+    if (newest_writer->compare_exchange_weak(newest, last_writer)) {
+      return (newest == nullptr);
+    }
+  }
+}
+
+void WriteThread::CreateMissingNewerLinks(Writer* head) {
+  while (true) {
+    Writer* next = head->link_older;
+    if (next == nullptr || next->link_newer != nullptr) {
+      assert(next == nullptr || next->link_newer == head);
+      break;
+    }
+    next->link_newer = head;
+    head = next;
+  }
+}
+
+WriteThread::Writer* WriteThread::FindNextLeader(Writer* from,
+                                                 Writer* boundary) {
+  assert(from != nullptr && from != boundary);
+  Writer* current = from;
+  while (current->link_older != boundary) {
+    current = current->link_older;
+    assert(current != nullptr);
+  }
+  return current;
+}
+
+void WriteThread::JoinBatchGroup(Writer* w) {
+  if (LinkOne(w, &newest_writer_)) {
+    // The queue was empty, so w leads the next group.
+    SetState(w, STATE_GROUP_LEADER);
+    return;
+  }
+  // A leader will either take w into its group, which ends in a
+  // memtable role or completion, or hand the log over to w.
+  AwaitState(w, STATE_GROUP_LEADER | STATE_MEMTABLE_WRITER_LEADER |
+                    STATE_PARALLEL_MEMTABLE_WRITER | STATE_COMPLETED);
+}
+
+bool WriteThread::JoinBatchGroupDetached(Writer* w) {
+  assert(w->detached);
+  if (LinkOne(w, &newest_writer_)) {
+    // Nobody else looks at the leader until it exits.
+    w->detached = false;
+    SetState(w, STATE_GROUP_LEADER);
+    return true;
+  }
+  return false;
+}
+
+size_t WriteThread::EnterAsBatchGroupLeader(Writer* leader,
+                                            WriteGroup* group) {
+  assert(leader->link_older == nullptr);
+  group->leader = leader;
+  group->last_writer = leader;
+  group->size = 1;
+  leader->write_group = group;
+  if (leader->batch == nullptr) {
+    return 0;
+  }
+
+  size_t size = WriteBatchInternal::ByteSize(leader->batch);
+  // Allow the group to grow up to a maximum size, but if the
+  // original write is small, limit the growth so we do not slow
+  // down the small write too much.
+  size_t max_size = 1 << 20;  // 1MB
+  if (size <= (128 << 10)) {  // 128KB
+    max_size = size + (128 << 10);
+  }
+
+  Writer* newest_writer = newest_writer_.load(std::memory_order_acquire);
+  CreateMissingNewerLinks(newest_writer);
+  Writer* w = leader;
+  while (w != newest_writer) {
+    w = w->link_newer;
+    if (w->batch == nullptr) {
+      // A write without a batch asks for a memtable switch; it is
+      // handled by itself as the next leader.
+      break;
+    }
+    const size_t batch_size = WriteBatchInternal::ByteSize(w->batch);
+    if (size + batch_size > max_size) {
+      // Do not make batch too big
+      break;
+    }
+    size += batch_size;
+    w->write_group = group;
+    group->last_writer = w;
+    group->size++;
+  }
+  return size;
+}
+
+void WriteThread::ExitAsBatchGroupLeader(WriteGroup& group, Status status) {
+  Writer* leader = group.leader;
+  Writer* last_writer = group.last_writer;
+  const bool insert = status.ok() && leader->batch != nullptr;
+
+  // Look for the next leader before linking the group to the memtable
+  // queue.  If nobody is waiting, park a dummy writer at the tail so the
+  // boundary of this group stays known.
+  Writer* next_leader = nullptr;
+  Writer dummy;
+  Writer* expected = last_writer;
+  const bool has_dummy =
+      newest_writer_.compare_exchange_strong(expected, &dummy);
+  if (!has_dummy) {
+    next_leader = FindNextLeader(expected, last_writer);
+  }
+
+  // The group must join the memtable queue before the next leader can
+  // run, or the next group could overtake it there.
+  if (insert && LinkGroup(group, &newest_memtable_writer_)) {
+    SetState(leader, STATE_MEMTABLE_WRITER_LEADER);
+  }
+
+  // Remove the dummy again; writers that arrived in the meantime are
+  // linked behind it.
+  if (has_dummy) {
+    expected = &dummy;
+    if (!newest_writer_.compare_exchange_strong(expected, nullptr)) {
+      next_leader = FindNextLeader(expected, &dummy);
+    }
+  }
+
+  if (!insert) {
+    // Nothing of this group reaches the memtable.  Only now that the
+    // group is off the writer queue may the followers complete: one
+    // that writes again could reuse its old address, which the
+    // compare-exchanges above would mistake for last_writer.
+    for (Writer* w = last_writer; w != leader;) {
+      Writer* next = w->link_older;
+      w->status = status;
+      CompleteWriter(w);
+      w = next;
+    }
+  }
+
+  if (next_leader != nullptr) {
+    next_leader->link_older = nullptr;
+    if (next_leader->detached) {
+      // Its caller is gone, so it needs a thread to lead on.
+      next_leader->detached = false;
+      next_leader->state.store(STATE_GROUP_LEADER, std::memory_order_release);
+      schedule_detached_leader_(next_leader);
+    } else {
+      SetState(next_leader, STATE_GROUP_LEADER);
+    }
+  }
+
+  if (insert) {
+    AwaitState(leader, STATE_MEMTABLE_WRITER_LEADER |
+                           STATE_PARALLEL_MEMTABLE_WRITER | STATE_COMPLETED);
+  }
+}
+
+void WriteThread::EnterAsMemTableWriter(Writer* leader, WriteGroup* group) {
+  assert(leader->link_older == nullptr);
+  assert(leader->batch != nullptr);
+  group->leader = leader;
+  group->size = 1;
+  group->status = Status::OK();
+  leader->write_group = group;
+
+  Writer* last_writer = leader;
+  Writer* newest_writer = newest_memtable_writer_.load(std::memory_order_acquire);
+  CreateMissingNewerLinks(newest_writer);
+  Writer* w = leader;
+  while (w != newest_writer) {
+    w = w->link_newer;
+    if (w->batch == nullptr) {
+      // WaitForMemTableWriters() placeholder
+      break;
+    }
+    w->write_group = group;
+    last_writer = w;
+    group->size++;
+  }
+  group->last_writer = last_writer;
+  group->last_sequence = last_writer->sequence +
+                         WriteBatchInternal::Count(last_writer->batch) - 1;
+}
+
+void WriteThread::LaunchParallelMemTableWriters(WriteGroup* group) {
+  assert(group != nullptr);
+  assert(!group->leader->detached);
+  size_t running = 0;
+  for (Writer* w = group->leader;; w = w->link_newer) {
+    if (!w->detached) {
+      running++;
+    }
+    if (w == group->last_writer) {
+      break;
+    }
+  }
+  group->running.store(running);
+  Writer* w = group->leader;
+  while (true) {
+    // Read the link first: w may finish and go away once woken.
+    Writer* next = w->link_newer;
+    const bool last = (w == group->last_writer);
+    if (!w->detached) {
+      SetState(w, STATE_PARALLEL_MEMTABLE_WRITER);
+    }
+    if (last) {
+      break;
+    }
+    w = next;
+  }
+}
+
+bool WriteThread::CompleteParallelMemTableWriter(Writer* w) {
+  WriteGroup* group = w->write_group;
+  if (!w->status.ok()) {
+    std::lock_guard<std::mutex> guard(group->leader->state_mutex);
+    group->status = w->status;
+  }
+  if (group->running.fetch_sub(1) > 1) {
+    // Not the last one: the last one completes us.
+    AwaitState(w, STATE_COMPLETED);
+    return false;
+  }
+  // The last one to finish performs the exit duties.
+  w->status = group->status;
+  return true;
+}
+
+void WriteThread::ExitAsMemTableWriter(Writer* self, WriteGroup& group) {
+  (void)self;
+  Writer* leader = group.leader;
+  Writer* last_writer = group.last_writer;
+
+  Writer* newest_writer = last_writer;
+  if (!newest_memtable_writer_.compare_exchange_strong(newest_writer,
+                                                       nullptr)) {
+    CreateMissingNewerLinks(newest_writer);
+    Writer* next_leader = last_writer->link_newer;
+    assert(next_leader != nullptr);
+    next_leader->link_older = nullptr;
+    SetState(next_leader, STATE_MEMTABLE_WRITER_LEADER);
+  }
+
+  Writer* w = leader;
+  while (true) {
+    if (!group.status.ok()) {
+      w->status = group.status;
+    }
+    Writer* next = w->link_newer;
+    if (w != leader) {
+      CompleteWriter(w);
+    }
+    if (w == last_writer) {
+      break;
+    }
+    w = next;
+  }
+  // The leader has to go last since the group lives on its stack.
+  assert(!leader->detached);
+  SetState(leader, STATE_COMPLETED);
+}
+
+void WriteThread::WaitForMemTableWriters() {
+  if (newest_memtable_writer_.load(std::memory_order_acquire) == nullptr) {
+    return;
+  }
+  // Queue a placeholder without a batch; it becomes memtable leader once
+  // every group ahead of it is done.  Only the group leader adds to the
+  // memtable queue, so nothing can join behind the placeholder.
+  Writer w;
+  if (!LinkOne(&w, &newest_memtable_writer_)) {
+    AwaitState(&w, STATE_MEMTABLE_WRITER_LEADER);
+  }
+  newest_memtable_writer_.store(nullptr, std::memory_order_release);
+}
+
+}  // namespace minilsm
@@ -0,0 +1,187 @@
+#ifndef MINILSM_DB_WRITE_THREAD_H_
+#define MINILSM_DB_WRITE_THREAD_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+#include "db/dbformat.h"
+#include "minilsm/status.h"
+
+namespace minilsm {
+
+class WriteBatch;
+
+// WriteThread queues the writers of a DB and forms them into groups.
+//
+// Writers join a lock-free list by swapping themselves in as its newest
+// entry; the writer that finds the list empty leads the next group
+// through the log.  A logged group is linked into a second list, from
+// which groups are applied to the memtable in log order while the
+// following group is being logged.  Waiting writers spin, then yield,
+// then block on their own mutex, so a hand-off between threads that
+// are already running costs no system call.
+//
+// A detached writer has no thread waiting on it.  As a follower it is
+// logged and inserted by its leaders and finished by running its
+// callback; when the log is handed to it, it is passed to the
+// schedule function given at construction, whose thread then runs it
+// like any leader.
+class WriteThread {
+public:
+  enum State : uint8_t {
+    // Queued and waiting to be picked up by a leader.
+    STATE_INIT = 1,
+
+    // Leader of a group: must log it and call ExitAsBatchGroupLeader.
+    STATE_GROUP_LEADER = 2,
+
+    // Front of the memtable queue: must call EnterAsMemTableWriter,
+    // apply the group it gets, and call ExitAsMemTableWriter.
+    STATE_MEMTABLE_WRITER_LEADER = 4,
+
+    // Asked by a memtable leader to insert its own batch, then call
+    // CompleteParallelMemTableWriter.
+    STATE_PARALLEL_MEMTABLE_WRITER = 8,
+
+    // Finished; status holds the result.
+    STATE_COMPLETED = 16,
+
+    // Blocked on state_mutex; changing state requires a notify.
+    STATE_LOCKED_WAITING = 32,
+  };
+
+  struct Writer;
+
+  struct WriteGroup {
+    Writer* leader = nullptr;
+    Writer* last_writer = nullptr;
+    SequenceNumber last_sequence = 0;
+    // Shared status of a memtable group, written under the leader's
+    // state_mutex by parallel writers.
+    Status status;
+    std::atomic<size_t> running{0};
+    size_t size = 0;
+  };
+
+  struct Writer {
+    Writer() : Writer(nullptr, false) {}
+    Writer(WriteBatch* b, bool s)
+        : batch(b),
+          sync(s),
+          detached(false),
+          sequence(0),
+          write_group(nullptr),
+          state(STATE_INIT),
+          link_older(nullptr),
+          link_newer(nullptr) {}
+
+    WriteBatch* batch;
+    bool sync;
+    // Heap-allocated, with no thread waiting on it.  Cleared once some
+    // thread takes over as its leader.
+    bool detached;
+    // Run with the final status when a detached writer completes.
+    std::function<void(const Status&)> callback;
+    SequenceNumber sequence;  // First sequence number of batch
+    Status status;
+    WriteGroup* write_group;
+    std::atomic<uint8_t> state;
+    Writer* link_older;  // Read/write only before linking, or as leader
+    Writer* link_newer;  // Lazy, read/write only before linking, or as leader
+    std::mutex state_mutex;
+    std::condition_variable state_cv;
+  };
+
+  WriteThread(bool allow_concurrent_memtable_write,
+              std::function<void(Writer*)> schedule_detached_leader);
+  WriteThread(const WriteThread&) = delete;
+  WriteThread& operator=(const WriteThread&) = delete;
+
+  // Link w into the writer queue and wait until it is a group leader,
+  // a memtable leader, a parallel memtable writer or completed.
+  void JoinBatchGroup(Writer* w);
+
+  // Link detached w into the writer queue without waiting.  Returns
+  // true if w leads the next group, in which case the caller must run
+  // it; otherwise w is run by others and may be gone already.
+  bool JoinBatchGroupDetached(Writer* w);
+
+  // Form a group of leader and the writers queued behind it, bounded
+  // by size and stopping at any writer without a batch.  Returns the
+  // total byte size of the group's batches.
+  size_t EnterAsBatchGroupLeader(Writer* leader, WriteGroup* group);
+
+  // Hand the log over to the next leader.  If status is ok and the
+  // group has batches it moves on to the memtable queue and this waits
+  // until the leader has a memtable role or is done; otherwise the
+  // followers complete with status and this returns at once.
+  void ExitAsBatchGroupLeader(WriteGroup& group, Status status);
+
+  // Form a memtable group of leader and the logged writers behind it.
+  void EnterAsMemTableWriter(Writer* leader, WriteGroup* group);
+
+  // Wake every writer of group, the leader included, to insert its own
+  // batch in parallel.  Detached writers are not woken; the leader
+  // inserts their batches along with its own.
+  void LaunchParallelMemTableWriters(WriteGroup* group);
+
+  // Called by each parallel writer once its insert is done.  Returns
+  // true for the last one to finish, which must then publish the
+  // group's sequence numbers and call ExitAsMemTableWriter.
+  bool CompleteParallelMemTableWriter(Writer* w);
+
+  // Hand the memtable over to the next group and complete group.
+  void ExitAsMemTableWriter(Writer* self, WriteGroup& group);
+
+  // Wait until every logged group has been applied to the memtable.
+  // REQUIRES: the caller is the current group leader
+  void WaitForMemTableWriters();
+
+  // Wait until w's state is in goal_mask and return it.
+  uint8_t AwaitState(Writer* w, uint8_t goal_mask);
+
+  static void SetState(Writer* w, uint8_t new_state);
+
+private:
+  // Complete w with its status.  A detached writer is finished here:
+  // its callback runs on the calling thread and it is deleted.
+  static void CompleteWriter(Writer* w);
+
+  static uint8_t BlockingAwaitState(Writer* w, uint8_t goal_mask);
+
+  // Push w onto the list; returns true if the list was empty.
+  static bool LinkOne(Writer* w, std::atomic<Writer*>* newest_writer);
+
+  // Push a whole group onto the list; returns true if it was empty.
+  static bool LinkGroup(WriteGroup& group,
+                        std::atomic<Writer*>* newest_writer);
+
+  // Fill in the link_newer pointers from head back to the first writer
+  // that already has one.
+  static void CreateMissingNewerLinks(Writer* head);
+
+  // Walk back from "from" to the writer linked right after "boundary".
+  static Writer* FindNextLeader(Writer* from, Writer* boundary);
+
+  const bool allow_concurrent_memtable_write_;
+  const std::function<void(Writer*)> schedule_detached_leader_;
+
+  // Newest writer waiting to be logged, or nullptr.
+  std::atomic<Writer*> newest_writer_;
+
+  // Newest logged writer waiting for the memtable, or nullptr.
+  std::atomic<Writer*> newest_memtable_writer_;
+
+  // Decaying average of whether yielding ended a wait (> 0) or the
+  // waiter had to block anyway (< 0).  Waiters skip yielding while it
+  // is negative.
+  std::atomic<int32_t> yield_credit_;
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_DB_WRITE_THREAD_H_
@@ -24,9 +24,10 @@ void TestIterator(DB* db_ptr) {
 int main() {
   minilsm::DB* db;
   minilsm::Options options;
+  options.create_if_missing = true;
 
   minilsm::Status status = minilsm::DB::Open(options,
-                                             "~/db/minilsm", 
+                                             "/tmp/minilsm", 
                                              &db);
   std::string key = "foo";
   std::string value = "abc";
@@ -7,6 +7,8 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <functional>
+#include <string>
 
 #include "minilsm/iterator.h"
 #include "minilsm/options.h"
@@ -32,6 +34,11 @@ struct Range {
 // any external synchronization.
 class DB {
  public:
+  // Completion callbacks of the asynchronous calls below.
+  using WriteCallback = std::function<void(const Status&)>;
+  using GetCallback =
+      std::function<void(const Status&, const std::string& value)>;
+
   // Open the database with the specified "name".
   // Stores a pointer to a heap-allocated database in *dbptr and returns
   // OK on success.
@@ -82,6 +89,23 @@ class DB {
   // The returned iterator should be deleted before this db is deleted.
   virtual Iterator* NewIterator(const ReadOptions& options) = 0;
 
+  // Like Write(), but returns without waiting for the write to be
+  // logged or applied, and calls "callback" with its status once it
+  // is.  The callback runs on whichever thread completes the write, a
+  // background thread or that of a concurrent writer, so it should be
+  // quick and must not block on other writes.  "updates" must stay
+  // alive and unchanged until the callback runs.  The default
+  // implementation just calls Write() and then the callback.
+  virtual void WriteAsync(const WriteOptions& options, WriteBatch* updates,
+                          WriteCallback callback);
+
+  // Like Get(), but calls "callback" with the status and the value
+  // (empty unless the status is OK) instead of returning them.  The
+  // lookup may run on a background thread.  It is not ordered behind
+  // concurrent writes, and is not held up while they are slowed down
+  // or stopped.
+  virtual void GetAsync(const ReadOptions& options, const Slice& key,
+                        GetCallback callback);
 };
 
 }  // namespace minilsm
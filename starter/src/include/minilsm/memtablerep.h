@@ -0,0 +1,158 @@
+// A MemTableRep is the in-memory index of a memtable: it holds the
+// memtable's encoded entries and finds them again.  The representation
+// is chosen through Options::memtable_factory.  The default, a skiplist,
+// suits every workload.  The hash-based ones trade ordered scans for
+// cheaper point lookups: entries are spread over buckets by a prefix
+// of their user key (Options::prefix_extractor), so a Get only searches
+// the bucket of its key, while a full scan has to sort the whole
+// memtable first.
+//
+// Entries are opaque to a representation; it orders them only through
+// the KeyComparator it is given, and reads their user key to pick a
+// bucket.  Writes are externally synchronized unless the factory
+// supports concurrent inserts.  Reads may run concurrently with each
+// other and with writes.
+
+#ifndef MINILSM_INCLUDE_MEMTABLEREP_H_
+#define MINILSM_INCLUDE_MEMTABLEREP_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace minilsm {
+
+class Arena;
+class LookupKey;
+class SliceTransform;
+
+class MemTableRep {
+ public:
+  // Orders entries, which start with their length-prefixed internal
+  // key.
+  class KeyComparator {
+   public:
+    virtual ~KeyComparator();
+
+    // Three-way comparison of two entries, or of an entry and a lookup
+    // key encoded the same way.
+    virtual int operator()(const char* a, const char* b) const = 0;
+
+    // A prefix of the entry that orders consistently with
+    // operator(): if Prefix(a) < Prefix(b) then a < b.  May be the same
+    // for every entry.
+    virtual uint64_t Prefix(const char* entry) const = 0;
+  };
+
+  explicit MemTableRep(Arena* arena) : arena_(arena) {}
+  MemTableRep(const MemTableRep&) = delete;
+  MemTableRep& operator=(const MemTableRep&) = delete;
+
+  virtual ~MemTableRep();
+
+  // Return a buffer of len bytes for an entry to be passed to Insert.
+  // If concurrent is true, several threads may allocate at once.
+  virtual char* Allocate(size_t len, bool concurrent);
+
+  // Insert an entry allocated by Allocate.
+  // REQUIRES: nothing that compares equal to entry is in the rep
+  virtual void Insert(const char* entry) = 0;
+
+  // Like Insert, but safe to call from several threads at once.  Only
+  // called if the factory supports concurrent inserts.
+  virtual void InsertConcurrently(const char* entry);
+
+  // Called once the memtable has become immutable; nothing is inserted
+  // after.
+  virtual void MarkReadOnly() {}
+
+  // Whether an entry that compares equal to key is in the rep.
+  virtual bool Contains(const char* key) const = 0;
+
+  // Call callback(arg, entry) for the entries at or after the memtable
+  // key of k, in order, until it returns false or the entries of the
+  // user key of k run out.  It may also be called with entries of
+  // later user keys.
+  virtual void Get(const LookupKey& k, void* arg,
+                   bool (*callback)(void* arg, const char* entry));
+
+  // Memory in use by the rep outside of the arena, in bytes.
+  virtual size_t ApproximateMemoryUsage() { return 0; }
+
+  // Iterates over the entries of the rep in order.  Seek takes an
+  // encoded lookup key.
+  class Iterator {
+   public:
+    virtual ~Iterator();
+    virtual bool Valid() const = 0;
+    // REQUIRES: Valid()
+    virtual const char* key() const = 0;
+    virtual void Next() = 0;
+    virtual void Prev() = 0;
+    virtual void Seek(const char* target) = 0;
+    virtual void SeekToFirst() = 0;
+    virtual void SeekToLast() = 0;
+  };
+
+  // Return an iterator over all entries.  The caller must delete it
+  // before the rep.
+  virtual Iterator* GetIterator() = 0;
+
+ protected:
+  Arena* const arena_;
+};
+
+// Creates the representation of each new memtable.  Implementations
+// must be thread-safe.
+class MemTableRepFactory {
+ public:
+  virtual ~MemTableRepFactory();
+
+  // Return a rep ordered by compare that allocates from arena.  Both
+  // outlive the result.  prefix_extractor is Options::prefix_extractor
+  // and may be null.
+  virtual MemTableRep* CreateMemTableRep(
+      const MemTableRep::KeyComparator& compare, Arena* arena,
+      const SliceTransform* prefix_extractor) const = 0;
+
+  virtual const char* Name() const = 0;
+
+  // Whether the reps support InsertConcurrently.  If not,
+  // Options::allow_concurrent_memtable_write is ignored.
+  virtual bool IsInsertConcurrentlySupported() const { return false; }
+};
+
+// The default: a skiplist holding every entry, with the entry stored
+// in its node.
+class SkipListFactory : public MemTableRepFactory {
+ public:
+  MemTableRep* CreateMemTableRep(
+      const MemTableRep::KeyComparator& compare, Arena* arena,
+      const SliceTransform* prefix_extractor) const override;
+  const char* Name() const override { return "SkipListFactory"; }
+  bool IsInsertConcurrentlySupported() const override { return true; }
+};
+
+// Return a factory for reps that hash the prefix of each user key to
+// one of bucket_count buckets, each a skiplist.  Suits buckets holding
+// many entries.  The bucket array, 8 bytes per bucket, counts against
+// Options::write_buffer_size.  Without a prefix_extractor the reps are
+// plain skiplists.  The caller must delete the result once no DB uses
+// it.
+MemTableRepFactory* NewHashSkipListRepFactory(size_t bucket_count = 16384);
+
+// Like NewHashSkipListRepFactory, but each bucket is a sorted linked
+// list, which is smaller and faster when buckets hold few entries.
+MemTableRepFactory* NewHashLinkListRepFactory(size_t bucket_count = 16384);
+
+// Return a factory for reps that append entries to a vector in arrival
+// order, the cheapest insert there is, for bulk loads.  The vector is
+// sorted in parallel, in place, once the memtable is immutable, by the
+// first iterator over it, which is normally the flush's.  Until then
+// every Get and iterator sorts a copy of the whole memtable, so reads
+// of a memtable being loaded are slow.  reserve entries are allocated
+// up front.  The caller must delete the result once no DB uses it.
+MemTableRepFactory* NewVectorRepFactory(size_t reserve = 0);
+
+}  // namespace minilsm
+
+#endif  // MINILSM_INCLUDE_MEMTABLEREP_H_
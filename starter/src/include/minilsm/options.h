@@ -2,10 +2,17 @@
 #define MINILSM_INCLUDE_OPTIONS_H_
 
 #include <cstddef>
+#include <cstdint>
 
 namespace minilsm {
 
+class Cache;
 class Comparator;
+class Env;
+class FilterPolicy;
+class MemTableRepFactory;
+class SliceTransform;
+class WriteBufferManager;
 
 // DB contents are stored in a set of blocks, each of which holds a
 // sequence of key,value pairs.  Each block may be compressed before
@@ -29,14 +36,110 @@ struct Options {
   bool error_if_exists = false;
   bool paranoid_checks = false;
 
+  // Use the specified object to interact with the environment,
+  // e.g. to read/write files.
+  // Default: Env::Default()
+  Env* env;
+
   // to do
-  // env
   // logger
-  // cache
-  // filter policy
+
+  // If non-null, use the specified cache for blocks.
+  // If null, minilsm will automatically create and use an 8MB internal cache.
+  Cache* block_cache = nullptr;
 
   // Amount of data to build up in memory
   size_t write_buffer_size = 4 * 1024 * 1024;
+
+  // Size of the blocks a memtable allocates its memory in.  0 picks
+  // write_buffer_size / 8.  Clipped to [4KB, write_buffer_size].
+  size_t arena_block_size = 0;
+
+  // If positive, memtables map their blocks in huge pages of this size,
+  // typically 2MB, rounding arena_block_size up to a multiple of it.
+  // Fewer, larger pages mean fewer TLB misses when Gets and Seeks walk
+  // a big memtable.  Reserved huge pages are used if the system has
+  // any and this is a multiple of their size (Hugepagesize in
+  // /proc/meminfo), else transparent huge pages are requested; without
+  // either, blocks come from the heap as usual.
+  // Default: 0 (regular pages)
+  size_t memtable_huge_page_size = 0;
+
+  // If non-null, caps the memory of the memtables of every DB that is
+  // given the same manager, on top of each DB's write_buffer_size.  See
+  // minilsm/write_buffer_manager.h.  Must outlive the DBs.
+  // Default: nullptr
+  WriteBufferManager* write_buffer_manager = nullptr;
+
+  // Maximum number of memtables, active and immutable, held in memory.
+  // Once the active memtable fills up and this many exist, writes wait
+  // for the oldest ones to be flushed.  Immutable memtables queued
+  // behind a running flush are merged into a single table by the next.
+  // Clipped to [2, 64].
+  int max_write_buffer_number = 2;
+
+  // Creates the in-memory representation of each memtable.  See
+  // minilsm/memtablerep.h.
+  // Default: a skiplist
+  MemTableRepFactory* memtable_factory;
+
+  // Maps each user key to the prefix that hash-based memtable
+  // representations group keys by.  Ignored by the skiplist.
+  // Default: nullptr
+  const SliceTransform* prefix_extractor = nullptr;
+
+  // If positive, each memtable keeps a bloom filter of the user keys
+  // written to it, taking up this fraction of write_buffer_size, and a
+  // Get skips the memtables whose filter rules its key out.  Worth it
+  // when most reads are for keys that were not written recently.
+  // Clipped to 0.25.
+  // Default: 0 (no filter)
+  double memtable_bloom_size_ratio = 0;
+
+  // If true, the writers of a batch group insert their own batches into
+  // the memtable in parallel once the leader has logged the group,
+  // instead of the leader applying the whole group alone.  Ignored if
+  // memtable_factory does not support concurrent inserts.
+  bool allow_concurrent_memtable_write = true;
+
+  // If true, a Put of a key whose latest version in the active memtable
+  // is a value at least as long overwrites that value in place rather
+  // than adding an entry, so keys that are rewritten over and over do
+  // not grow the memtable.  The old value is gone for good: iterators
+  // and Gets that started before the Put may see the new value, and an
+  // iterator reading the entry as it is overwritten sees garbage.  Turns
+  // off allow_concurrent_memtable_write.
+  // Default: false
+  bool inplace_update_support = false;
+
+  // Number of locks that guard the values overwritten in place, picked
+  // by hashing the user key.
+  size_t inplace_update_num_locks = 10000;
+
+  // Write stalls.  Once any soft limit below is reached, writes are
+  // slowed down to delayed_write_rate; once a hard limit is, they wait
+  // for background work to bring things back under it.  Writes also
+  // slow down while all but one of max_write_buffer_number memtables
+  // wait to be flushed, if that is more than two.
+
+  // Nothing compacts level-0 files into deeper levels yet, so their
+  // number and the pending compaction bytes only grow.  The limits on
+  // them are therefore off by default; a DB that sets them is
+  // eventually slowed down or stopped for good.
+
+  // Number of level-0 files at which writes slow down, and stop.
+  // 0 disables the trigger.
+  int level0_slowdown_writes_trigger = 0;
+  int level0_stop_writes_trigger = 0;
+
+  // Estimated bytes that compactions must rewrite to bring every level
+  // back under its target size, at which writes slow down, and stop.
+  // 0 disables the limit.
+  uint64_t soft_pending_compaction_bytes_limit = 0;
+  uint64_t hard_pending_compaction_bytes_limit = 0;
+
+  // Bytes per second admitted while writes are slowed down.
+  uint64_t delayed_write_rate = 16 << 20;
   int max_open_files = 1000;
   size_t block_size = 4 * 1024;
 
@@ -45,6 +148,20 @@ struct Options {
   size_t max_file_size = 2 * 1024 * 1024;
   CompressionType compression = kSnappyCompression;
 
+  // If non-null, use the specified filter policy to reduce disk reads.
+  // Each table then stores a filter of its keys for every 2KB of data
+  // blocks, and a Get skips the blocks whose filter rules its key out.
+  // Many applications will benefit from passing the result of
+  // NewBloomFilterPolicy() here.
+  // Default: nullptr
+  const FilterPolicy* filter_policy = nullptr;
+
+  // Number of threads that compress and checksum the data blocks of a
+  // table being built, while the building thread fills the next block.
+  // 0 does it all on the building thread.  Clipped to 16.
+  // Default: 0
+  int compression_parallel_threads = 0;
+
   bool reuse_logs;
 };
 
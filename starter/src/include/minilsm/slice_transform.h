@@ -0,0 +1,39 @@
+// A SliceTransform maps a user key to a shorter key, typically one of
+// its prefixes.  Hash-based memtable representations use it to group
+// the keys that share a transformed value into one bucket.
+
+#ifndef MINILSM_INCLUDE_SLICE_TRANSFORM_H_
+#define MINILSM_INCLUDE_SLICE_TRANSFORM_H_
+
+#include <cstddef>
+
+#include "minilsm/slice.h"
+
+namespace minilsm {
+
+// Implementations must be thread-safe, since their methods may be
+// invoked concurrently from multiple threads.
+class SliceTransform {
+ public:
+  virtual ~SliceTransform();
+
+  // The name of the transformation.
+  virtual const char* Name() const = 0;
+
+  // Return the transformed key.  The result may point into key.
+  // REQUIRES: InDomain(key)
+  virtual Slice Transform(const Slice& key) const = 0;
+
+  // Whether key can be transformed.  Keys outside the domain are
+  // grouped by the whole key instead.
+  virtual bool InDomain(const Slice& key) const = 0;
+};
+
+// Return a transform that keeps the first prefix_len bytes of a key.
+// Keys shorter than prefix_len are outside its domain.  The caller
+// must delete the result when it is no longer needed.
+const SliceTransform* NewFixedPrefixTransform(size_t prefix_len);
+
+}  // namespace minilsm
+
+#endif  // MINILSM_INCLUDE_SLICE_TRANSFORM_H_
@@ -0,0 +1,75 @@
+// WriteBatchWithIndex is a WriteBatch that can be read back before it
+// is written.  Alongside the batch it keeps a sorted index of the
+// staged updates, so that a key can be looked up in the batch, or in
+// the batch on top of a DB, and the batch can be iterated together
+// with a DB iterator.
+//
+//    WriteBatchWithIndex batch;
+//    batch.Put("key", "v1");
+//    batch.GetFromBatchAndDB(db, ReadOptions(), "key", &value);  // "v1"
+//    db->Write(WriteOptions(), batch.GetWriteBatch());
+//
+// Like WriteBatch, const methods may be invoked from multiple threads
+// without external synchronization, but non-const methods require it.
+
+#ifndef MINILSM_INCLUDE_WRITE_BATCH_WITH_INDEX_H_
+#define MINILSM_INCLUDE_WRITE_BATCH_WITH_INDEX_H_
+
+#include <string>
+
+#include "minilsm/comparator.h"
+#include "minilsm/iterator.h"
+#include "minilsm/options.h"
+#include "minilsm/status.h"
+#include "minilsm/write_batch.h"
+
+namespace minilsm {
+
+class DB;
+class Slice;
+
+class WriteBatchWithIndex {
+ public:
+  // "comparator" orders the index.  It must be the comparator of the
+  // DBs the batch is read together with.
+  explicit WriteBatchWithIndex(
+      const Comparator* comparator = BytewiseComparator());
+
+  WriteBatchWithIndex(const WriteBatchWithIndex&) = delete;
+  WriteBatchWithIndex& operator=(const WriteBatchWithIndex&) = delete;
+
+  ~WriteBatchWithIndex();
+
+  // Same as the WriteBatch methods, also updating the index.
+  void Put(const Slice& key, const Slice& value);
+  void Delete(const Slice& key);
+  void Clear();
+
+  // The staged updates, to pass to DB::Write.  Must not be modified
+  // other than through this class.
+  WriteBatch* GetWriteBatch();
+
+  // If the batch holds a Put for "key", store the value of the latest
+  // one in *value and return OK.  If it holds no update for "key", or
+  // the latest one is a Delete, return a NotFound status.
+  Status GetFromBatch(const Slice& key, std::string* value) const;
+
+  // Like db->Get(options, key, value), as if the batch had been written
+  // to db: an update staged for "key" takes precedence over db.
+  Status GetFromBatchAndDB(DB* db, const ReadOptions& options,
+                           const Slice& key, std::string* value) const;
+
+  // Return an iterator over base_iterator, an iterator returned by
+  // DB::NewIterator, with the staged updates applied on top of it.
+  // Takes ownership of base_iterator.  The batch must outlive the
+  // result and must not be modified while the result is in use.
+  Iterator* NewIteratorWithBase(Iterator* base_iterator) const;
+
+ private:
+  struct Rep;
+  Rep* rep_;
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_INCLUDE_WRITE_BATCH_WITH_INDEX_H_
@@ -0,0 +1,69 @@
+// A WriteBufferManager bounds the memory taken by the memtables of all
+// the DBs that share it through Options::write_buffer_manager.  Each DB
+// still switches memtables at its own write_buffer_size; once the
+// memtables together outgrow the manager's budget, the largest memtable
+// still being written is flushed, whichever DB it belongs to.
+
+#ifndef MINILSM_INCLUDE_WRITE_BUFFER_MANAGER_H_
+#define MINILSM_INCLUDE_WRITE_BUFFER_MANAGER_H_
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace minilsm {
+
+class MemTable;
+
+// Safe for concurrent use by any number of DBs.  Must outlive them.
+class WriteBufferManager {
+ public:
+  explicit WriteBufferManager(size_t buffer_size);
+
+  WriteBufferManager(const WriteBufferManager&) = delete;
+  WriteBufferManager& operator=(const WriteBufferManager&) = delete;
+
+  ~WriteBufferManager();
+
+  size_t buffer_size() const { return buffer_size_; }
+
+  // Bytes held by the memtables of all the DBs, including those that
+  // are waiting to be flushed.
+  size_t memory_usage() const;
+
+  // The rest is used by the DBs sharing the manager.
+
+  // Count mem until RemoveMemTable.
+  void AddMemTable(MemTable* mem);
+  void RemoveMemTable(MemTable* mem);
+
+  // mem is the memtable its DB is writing to, and flush switches it out
+  // for a fresh one and flushes it.  flush is called with the manager's
+  // lock held, so it must not block or call back into the manager.
+  void SetActive(MemTable* mem, std::function<void()> flush);
+
+  // mem will not be written to any more; it still counts until removed.
+  void MarkImmutable(MemTable* mem);
+
+  // If the memtables are over budget, ask for the largest active one
+  // that is not being flushed yet to be flushed.  Memory that flushes
+  // in progress are about to free up is taken into account, so that a
+  // burst of writes does not flush every memtable at once.
+  void MaybeFlush();
+
+ private:
+  struct Entry {
+    // Empty unless the memtable is active.
+    std::function<void()> flush;
+    bool flush_requested = false;
+  };
+
+  const size_t buffer_size_;
+  mutable std::mutex mu_;
+  std::unordered_map<MemTable*, Entry> memtables_;  // Guarded by mu_
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_INCLUDE_WRITE_BUFFER_MANAGER_H_
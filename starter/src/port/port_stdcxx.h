@@ -62,6 +62,15 @@ private:
   Mutex* const mu_;
 };
 
+// Hint to the CPU that the caller is spinning on a memory location.
+inline void AsmVolatilePause() {
+#if defined(__i386__) || defined(__x86_64__)
+  asm volatile("pause");
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
 inline bool Snappy_Compress(const char* input, size_t length,
                             std::string* output) {
 #if HAVE_SNAPPY
@@ -34,5 +34,13 @@ TEST(FormatTest, FooterManipulate) {
   std::string s;
   footer.EncodeTo(&s);
   ASSERT_EQ(s.size(), Footer::kEncodedLength);
+
+  Footer decoded;
+  Slice input(s);
+  ASSERT_TRUE(decoded.DecodeFrom(&input).ok());
+  ASSERT_EQ(1234, decoded.metaindex_handle().offset());
+  ASSERT_EQ(120, decoded.metaindex_handle().size());
+  ASSERT_EQ(5678, decoded.index_handle().offset());
+  ASSERT_EQ(230, decoded.index_handle().size());
 } 
 }
\ No newline at end of file
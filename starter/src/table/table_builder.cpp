@@ -0,0 +1,433 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "minilsm/table_builder.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "minilsm/comparator.h"
+#include "minilsm/env.h"
+#include "minilsm/filter_policy.h"
+#include "port/port.h"
+#include "table/block_builder.h"
+#include "table/filter_block.h"
+#include "table/format.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+
+namespace minilsm {
+
+namespace {
+
+// Compress raw as type asks, falling back to storing it as is if that
+// does not pay off.  *contents is set to what should be stored, which
+// may point into *compressed.
+CompressionType CompressBlock(CompressionType type, const Slice& raw,
+                              std::string* compressed, Slice* contents) {
+  switch (type) {
+    case kNoCompression:
+      *contents = raw;
+      break;
+
+    case kSnappyCompression: {
+      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
+          compressed->size() < raw.size() - (raw.size() / 8u)) {
+        *contents = *compressed;
+      } else {
+        // Snappy not supported, or compressed less than 12.5%, so just
+        // store uncompressed form
+        *contents = raw;
+        type = kNoCompression;
+      }
+      break;
+    }
+  }
+  return type;
+}
+
+void EncodeBlockTrailer(const Slice& contents, CompressionType type,
+                        char* trailer) {
+  trailer[0] = type;
+  uint32_t crc = crc32c::Value(contents.data(), contents.size());
+  crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
+  EncodeFixed32(trailer + 1, crc32c::Mask(crc));
+}
+
+}  // namespace
+
+// A data block handed to the compression threads.
+struct TableBuilder::BlockJob {
+  std::string raw;
+  std::string compressed;
+  // Set by the compression thread.
+  Slice contents;
+  char trailer[kBlockTrailerSize];
+  bool done = false;  // Guarded by Rep::mu
+
+  // The index entry for the block, known once the first key of the next
+  // block is.
+  bool has_index_key = false;
+  std::string index_key;
+
+  // Keys of the block, for the filter block.
+  std::vector<std::string> filter_keys;
+};
+
+struct TableBuilder::Rep {
+  Rep(const Options& opt, WritableFile* f)
+      : options(opt),
+        index_block_options(opt),
+        file(f),
+        offset(0),
+        data_block(&options),
+        index_block(&index_block_options),
+        num_entries(0),
+        closed(false),
+        filter_block(opt.filter_policy == nullptr
+                         ? nullptr
+                         : new FilterBlockBuilder(opt.filter_policy)),
+        pending_index_entry(false) {
+    index_block_options.block_restart_interval = 1;
+  }
+
+  Options options;
+  Options index_block_options;
+  WritableFile* file;
+  uint64_t offset;
+  Status status;
+  BlockBuilder data_block;
+  BlockBuilder index_block;
+  std::string last_key;
+  int64_t num_entries;
+  bool closed;  // Either Finish() or Abandon() has been called.
+  FilterBlockBuilder* filter_block;
+
+  // We do not emit the index entry for a block until we have seen the
+  // first key for the next data block.  This allows us to use shorter
+  // keys in the index block.  For example, consider a block boundary
+  // between the keys "the quick brown fox" and "the who".  We can use
+  // "the r" as the key for the index block entry since it is >= all
+  // entries in the first block and < all entries in subsequent
+  // blocks.
+  //
+  // Invariant: r->pending_index_entry is true only if data_block is empty.
+  bool pending_index_entry;
+  BlockHandle pending_handle;  // Handle to add to index block
+
+  std::string compressed_output;
+
+  // With compression threads, a finished data block is queued on work
+  // for them and on pending until it is written.  Blocks are written in
+  // the order they were finished, each once it is compressed and its
+  // index key is known, so the table comes out the same as without
+  // threads.
+  std::vector<std::thread> workers;
+  std::mutex mu;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  std::deque<BlockJob*> work;  // Guarded by mu
+  bool shutdown = false;       // Guarded by mu
+  std::deque<BlockJob*> pending;
+  // Keys of the data block being filled, for the filter block.
+  std::vector<std::string> filter_keys;
+};
+
+TableBuilder::TableBuilder(const Options& options, WritableFile* file)
+    : rep_(new Rep(options, file)) {
+  Rep* r = rep_;
+  if (r->filter_block != nullptr) {
+    r->filter_block->StartBlock(0);
+  }
+  for (int i = 0; i < options.compression_parallel_threads; i++) {
+    r->workers.emplace_back([r] {
+      std::unique_lock<std::mutex> l(r->mu);
+      while (true) {
+        r->work_cv.wait(l, [r] { return r->shutdown || !r->work.empty(); });
+        if (r->work.empty()) {
+          return;
+        }
+        BlockJob* job = r->work.front();
+        r->work.pop_front();
+        l.unlock();
+        const CompressionType type = CompressBlock(
+            r->options.compression, job->raw, &job->compressed,
+            &job->contents);
+        EncodeBlockTrailer(job->contents, type, job->trailer);
+        l.lock();
+        job->done = true;
+        r->done_cv.notify_all();
+      }
+    });
+  }
+}
+
+TableBuilder::~TableBuilder() {
+  assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
+  assert(rep_->workers.empty());
+  delete rep_->filter_block;
+  delete rep_;
+}
+
+void TableBuilder::Add(const Slice& key, const Slice& value) {
+  Rep* r = rep_;
+  assert(!r->closed);
+  if (!ok()) return;
+  if (r->num_entries > 0) {
+    assert(r->options.comparator->Compare(key, Slice(r->last_key)) > 0);
+  }
+
+  if (r->pending_index_entry) {
+    assert(r->data_block.empty());
+    r->options.comparator->FindShortestSeparator(&r->last_key, key);
+    if (r->workers.empty()) {
+      std::string handle_encoding;
+      r->pending_handle.EncodeTo(&handle_encoding);
+      r->index_block.Add(r->last_key, Slice(handle_encoding));
+    } else {
+      BlockJob* job = r->pending.back();
+      job->index_key = r->last_key;
+      job->has_index_key = true;
+    }
+    r->pending_index_entry = false;
+  }
+
+  if (r->filter_block != nullptr) {
+    if (r->workers.empty()) {
+      r->filter_block->AddKey(key);
+    } else {
+      // Which filter the key goes in depends on where its block ends up.
+      r->filter_keys.emplace_back(key.data(), key.size());
+    }
+  }
+
+  r->last_key.assign(key.data(), key.size());
+  r->num_entries++;
+  r->data_block.Add(key, value);
+
+  const size_t estimated_block_size = r->data_block.CurrentSizeEstimate();
+  if (estimated_block_size >= r->options.block_size) {
+    Flush();
+  }
+}
+
+void TableBuilder::Flush() {
+  Rep* r = rep_;
+  assert(!r->closed);
+  if (!ok()) return;
+  if (r->data_block.empty()) return;
+  assert(!r->pending_index_entry);
+  if (!r->workers.empty()) {
+    ScheduleDataBlock();
+    r->pending_index_entry = true;
+    WriteCompressedBlocks(false);
+    return;
+  }
+  WriteBlock(&r->data_block, &r->pending_handle);
+  if (ok()) {
+    r->pending_index_entry = true;
+    r->status = r->file->Flush();
+  }
+  if (r->filter_block != nullptr) {
+    r->filter_block->StartBlock(r->offset);
+  }
+}
+
+void TableBuilder::ScheduleDataBlock() {
+  Rep* r = rep_;
+  BlockJob* job = new BlockJob;
+  job->raw = r->data_block.Finish().ToString();
+  r->data_block.Reset();
+  job->filter_keys.swap(r->filter_keys);
+  r->pending.push_back(job);
+  {
+    std::lock_guard<std::mutex> l(r->mu);
+    r->work.push_back(job);
+  }
+  r->work_cv.notify_one();
+}
+
+void TableBuilder::WriteCompressedBlocks(bool wait) {
+  Rep* r = rep_;
+  bool wrote = false;
+  while (ok() && !r->pending.empty() && r->pending.front()->has_index_key) {
+    BlockJob* job = r->pending.front();
+    {
+      std::unique_lock<std::mutex> l(r->mu);
+      if (!job->done) {
+        // Keep filling blocks while the threads catch up, but not so far
+        // ahead that the queued blocks pile up in memory.
+        if (!wait && r->pending.size() <= 2 * r->workers.size()) {
+          break;
+        }
+        r->done_cv.wait(l, [job] { return job->done; });
+      }
+    }
+    if (r->filter_block != nullptr) {
+      for (const std::string& key : job->filter_keys) {
+        r->filter_block->AddKey(key);
+      }
+    }
+    BlockHandle handle;
+    AppendBlock(job->contents, job->trailer, &handle);
+    if (ok()) {
+      std::string handle_encoding;
+      handle.EncodeTo(&handle_encoding);
+      r->index_block.Add(job->index_key, Slice(handle_encoding));
+      if (r->filter_block != nullptr) {
+        r->filter_block->StartBlock(r->offset);
+      }
+    }
+    r->pending.pop_front();
+    delete job;
+    wrote = true;
+  }
+  if (wrote && ok()) {
+    r->status = r->file->Flush();
+  }
+}
+
+void TableBuilder::StopCompressionThreads() {
+  Rep* r = rep_;
+  {
+    std::lock_guard<std::mutex> l(r->mu);
+    r->shutdown = true;
+    r->work.clear();
+  }
+  r->work_cv.notify_all();
+  for (std::thread& worker : r->workers) {
+    worker.join();
+  }
+  r->workers.clear();
+  // Left over if writing failed.
+  for (BlockJob* job : r->pending) {
+    delete job;
+  }
+  r->pending.clear();
+}
+
+void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
+  // File format contains a sequence of blocks where each block has:
+  //    block_data: uint8[n]
+  //    type: uint8
+  //    crc: uint32
+  assert(ok());
+  Rep* r = rep_;
+  Slice raw = block->Finish();
+
+  Slice block_contents;
+  const CompressionType type = CompressBlock(
+      r->options.compression, raw, &r->compressed_output, &block_contents);
+  WriteRawBlock(block_contents, type, handle);
+  r->compressed_output.clear();
+  block->Reset();
+}
+
+void TableBuilder::WriteRawBlock(const Slice& block_contents,
+                                 CompressionType type, BlockHandle* handle) {
+  char trailer[kBlockTrailerSize];
+  EncodeBlockTrailer(block_contents, type, trailer);
+  AppendBlock(block_contents, trailer, handle);
+}
+
+void TableBuilder::AppendBlock(const Slice& block_contents,
+                               const char* trailer, BlockHandle* handle) {
+  Rep* r = rep_;
+  handle->set_offset(r->offset);
+  handle->set_size(block_contents.size());
+  r->status = r->file->Append(block_contents);
+  if (r->status.ok()) {
+    r->status = r->file->Append(Slice(trailer, kBlockTrailerSize));
+    if (r->status.ok()) {
+      r->offset += block_contents.size() + kBlockTrailerSize;
+    }
+  }
+}
+
+Status TableBuilder::status() const { return rep_->status; }
+
+// | data blocks | filter block | metaindex block | index block | footer |
+Status TableBuilder::Finish() {
+  Rep* r = rep_;
+  Flush();
+  assert(!r->closed);
+  r->closed = true;
+
+  if (!r->workers.empty()) {
+    if (ok() && r->pending_index_entry) {
+      r->options.comparator->FindShortSuccessor(&r->last_key);
+      BlockJob* job = r->pending.back();
+      job->index_key = r->last_key;
+      job->has_index_key = true;
+      r->pending_index_entry = false;
+    }
+    WriteCompressedBlocks(true);
+    StopCompressionThreads();
+  }
+
+  BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+
+  // Write filter block
+  if (ok() && r->filter_block != nullptr) {
+    WriteRawBlock(r->filter_block->Finish(), kNoCompression,
+                  &filter_block_handle);
+  }
+
+  // Write metaindex block
+  if (ok()) {
+    BlockBuilder meta_index_block(&r->options);
+    if (r->filter_block != nullptr) {
+      // Add mapping from "filter.Name" to location of filter data
+      std::string key = "filter.";
+      key.append(r->options.filter_policy->Name());
+      std::string handle_encoding;
+      filter_block_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add(key, handle_encoding);
+    }
+    WriteBlock(&meta_index_block, &metaindex_block_handle);
+  }
+
+  // Write index block
+  if (ok()) {
+    if (r->pending_index_entry) {
+      r->options.comparator->FindShortSuccessor(&r->last_key);
+      std::string handle_encoding;
+      r->pending_handle.EncodeTo(&handle_encoding);
+      r->index_block.Add(r->last_key, Slice(handle_encoding));
+      r->pending_index_entry = false;
+    }
+    WriteBlock(&r->index_block, &index_block_handle);
+  }
+
+  // Write footer
+  if (ok()) {
+    Footer footer;
+    footer.set_metaindex_handle(metaindex_block_handle);
+    footer.set_index_handle(index_block_handle);
+    std::string footer_encoding;
+    footer.EncodeTo(&footer_encoding);
+    r->status = r->file->Append(footer_encoding);
+    if (r->status.ok()) {
+      r->offset += footer_encoding.size();
+    }
+  }
+  return r->status;
+}
+
+void TableBuilder::Abandon() {
+  Rep* r = rep_;
+  assert(!r->closed);
+  r->closed = true;
+  StopCompressionThreads();
+}
+
+uint64_t TableBuilder::NumEntries() const { return rep_->num_entries; }
+
+uint64_t TableBuilder::FileSize() const { return rep_->offset; }
+
+}  // namespace minilsm
@@ -0,0 +1,183 @@
+#include "minilsm/table.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "minilsm/cache.h"
+#include "minilsm/comparator.h"
+#include "minilsm/env.h"
+#include "minilsm/filter_policy.h"
+#include "minilsm/options.h"
+#include "minilsm/table_builder.h"
+#include "util/random.h"
+
+#include <gtest/gtest.h>
+
+namespace minilsm {
+
+class TableTest : public testing::Test {
+ public:
+  TableTest() : env_(Env::Default()), table_(nullptr), file_(nullptr) {
+    fname_ = testing::TempDir() + "minilsm_table_test.ldb";
+  }
+  ~TableTest() override {
+    delete table_;
+    delete file_;
+    env_->DeleteFile(fname_);
+  }
+
+  // Write model to a table and open it.
+  void Build(const Options& options,
+             const std::map<std::string, std::string>& model) {
+    WritableFile* out;
+    ASSERT_TRUE(env_->NewWritableFile(fname_, &out).ok());
+    TableBuilder builder(options, out);
+    for (const auto& kv : model) {
+      builder.Add(kv.first, kv.second);
+    }
+    ASSERT_TRUE(builder.Finish().ok());
+    ASSERT_TRUE(out->Close().ok());
+    delete out;
+    file_size_ = builder.FileSize();
+
+    ASSERT_TRUE(env_->NewRandomAccessFile(fname_, &file_).ok());
+    ASSERT_TRUE(Table::Open(options, file_, file_size_, &table_).ok());
+  }
+
+  Env* env_;
+  std::string fname_;
+  uint64_t file_size_;
+  Table* table_;
+  RandomAccessFile* file_;
+};
+
+TEST_F(TableTest, IterateAndSeek) {
+  std::unique_ptr<Cache> cache(NewLRUCache(1 << 20));
+  Options options;
+  options.block_size = 256;
+  options.block_cache = cache.get();
+  std::map<std::string, std::string> model;
+  Random rnd(301);
+  for (int i = 0; i < 2000; i++) {
+    model["k" + std::to_string(rnd.Uniform(100000))] =
+        std::string(rnd.Uniform(300), 'a' + i % 26);
+  }
+  Build(options, model);
+
+  ReadOptions read_options;
+  read_options.verify_checksums = true;
+  Iterator* iter = table_->NewIterator(read_options);
+  auto it = model.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != model.end());
+    ASSERT_EQ(it->first, iter->key().ToString());
+    ASSERT_EQ(it->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(it == model.end());
+  ASSERT_TRUE(iter->status().ok());
+
+  auto rit = model.rbegin();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rit) {
+    ASSERT_EQ(rit->first, iter->key().ToString());
+  }
+  ASSERT_TRUE(rit == model.rend());
+
+  for (int i = 0; i < 1000; i++) {
+    const std::string target = "k" + std::to_string(rnd.Uniform(100000));
+    iter->Seek(target);
+    auto expected = model.lower_bound(target);
+    if (expected == model.end()) {
+      ASSERT_FALSE(iter->Valid());
+    } else {
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(expected->first, iter->key().ToString());
+      ASSERT_EQ(expected->second, iter->value().ToString());
+    }
+  }
+  delete iter;
+}
+
+TEST_F(TableTest, ApproximateOffsetOf) {
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  std::map<std::string, std::string> model;
+  model["k01"] = "hello";
+  model["k02"] = "hello2";
+  model["k03"] = std::string(10000, 'x');
+  model["k04"] = std::string(200000, 'x');
+  model["k05"] = std::string(300000, 'x');
+  model["k06"] = "hello3";
+  model["k07"] = std::string(100000, 'x');
+  Build(options, model);
+
+  auto between = [](uint64_t val, uint64_t low, uint64_t high) {
+    return val >= low && val <= high;
+  };
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("abc"), 0, 0));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k01"), 0, 0));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k01a"), 0, 0));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k02"), 0, 0));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k03"), 0, 0));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k04"), 10000, 11000));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k04a"), 210000, 211000));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k05"), 210000, 211000));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k06"), 510000, 511000));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("k07"), 510000, 511000));
+  ASSERT_TRUE(between(table_->ApproximateOffsetOf("xyz"), 610000, 612000));
+}
+
+TEST_F(TableTest, ParallelCompression) {
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  Options options;
+  options.block_size = 512;
+  options.filter_policy = policy.get();
+  std::map<std::string, std::string> model;
+  Random rnd(301);
+  for (int i = 0; i < 5000; i++) {
+    // A mix of blocks that compress and blocks that do not.
+    std::string value;
+    const bool compressible = (i / 20) % 2 == 0;
+    for (uint32_t n = rnd.Uniform(200); n > 0; n--) {
+      value.push_back(compressible ? 'a' : ' ' + rnd.Uniform(95));
+    }
+    model["k" + std::to_string(100000 + i)] = value;
+  }
+  Build(options, model);
+  std::string serial;
+  ASSERT_TRUE(ReadFileToString(env_, fname_, &serial).ok());
+  delete table_;
+  delete file_;
+  table_ = nullptr;
+  file_ = nullptr;
+
+  options.compression_parallel_threads = 4;
+  Build(options, model);
+  std::string parallel;
+  ASSERT_TRUE(ReadFileToString(env_, fname_, &parallel).ok());
+  ASSERT_EQ(serial.size(), file_size_);
+  ASSERT_TRUE(serial == parallel);
+
+  Iterator* iter = table_->NewIterator(ReadOptions());
+  auto it = model.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_EQ(it->first, iter->key().ToString());
+    ASSERT_EQ(it->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(it == model.end());
+  delete iter;
+}
+
+TEST_F(TableTest, RejectsBadFooter) {
+  Options options;
+  std::map<std::string, std::string> model{{"a", "1"}};
+  Build(options, model);
+  delete table_;
+  table_ = nullptr;
+  // Too short to hold a footer.
+  ASSERT_TRUE(Table::Open(options, file_, 10, &table_).IsCorruption());
+  ASSERT_EQ(nullptr, table_);
+}
+
+}  // namespace minilsm
@@ -0,0 +1,88 @@
+// Compares the filter policies: the false positive rate and size of a
+// filter of the given number of keys at 10 bits per key, or for Ribbon
+// the bloom filter's false positive rate, and the time a probe for an
+// absent key takes.  Filters larger than the CPU caches show the cost of
+// the cache misses a probe takes.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "minilsm/filter_policy.h"
+#include "minilsm/slice.h"
+
+namespace {
+
+using minilsm::FilterPolicy;
+using minilsm::Slice;
+
+void BM_FilterProbe(benchmark::State& state, const FilterPolicy* policy) {
+  const int num_keys = static_cast<int>(state.range(0));
+  std::vector<std::string> keys;
+  for (int i = 0; i < num_keys; i++) {
+    keys.push_back("key" + std::to_string(i));
+  }
+  std::vector<Slice> key_slices(keys.begin(), keys.end());
+  std::string filter;
+  policy->CreateFilter(key_slices.data(), num_keys, &filter);
+
+  // Probe keys are built in advance, so that only the probe is timed.
+  const int kNumProbes = 1 << 16;
+  std::vector<std::string> probes;
+  for (int i = 0; i < kNumProbes; i++) {
+    probes.push_back("missing" + std::to_string(i));
+  }
+
+  int64_t matches = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    matches += policy->KeyMayMatch(probes[i], filter);
+    i = (i + 1) & (kNumProbes - 1);
+  }
+  state.counters["fp_rate"] =
+      static_cast<double>(matches) / state.iterations();
+  state.counters["bits_per_key"] =
+      filter.size() * 8.0 / num_keys;
+}
+
+const FilterPolicy* const bloom = minilsm::NewBloomFilterPolicy(10);
+const FilterPolicy* const blocked_bloom =
+    minilsm::NewBlockedBloomFilterPolicy(10);
+const FilterPolicy* const ribbon = minilsm::NewRibbonFilterPolicy(10);
+
+BENCHMARK_CAPTURE(BM_FilterProbe, bloom, bloom)
+    ->Arg(10 << 10)
+    ->Arg(1 << 20)
+    ->Arg(10 << 20);
+BENCHMARK_CAPTURE(BM_FilterProbe, blocked_bloom, blocked_bloom)
+    ->Arg(10 << 10)
+    ->Arg(1 << 20)
+    ->Arg(10 << 20);
+BENCHMARK_CAPTURE(BM_FilterProbe, ribbon, ribbon)
+    ->Arg(10 << 10)
+    ->Arg(1 << 20)
+    ->Arg(10 << 20);
+
+// Time to build a filter of the given number of keys, as a table does
+// for each data block.
+void BM_FilterCreate(benchmark::State& state, const FilterPolicy* policy) {
+  const int num_keys = static_cast<int>(state.range(0));
+  std::vector<std::string> keys;
+  for (int i = 0; i < num_keys; i++) {
+    keys.push_back("key" + std::to_string(i));
+  }
+  std::vector<Slice> key_slices(keys.begin(), keys.end());
+  for (auto _ : state) {
+    std::string filter;
+    policy->CreateFilter(key_slices.data(), num_keys, &filter);
+    benchmark::DoNotOptimize(filter.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_keys);
+}
+
+BENCHMARK_CAPTURE(BM_FilterCreate, bloom, bloom)->Arg(40)->Arg(10 << 10);
+BENCHMARK_CAPTURE(BM_FilterCreate, ribbon, ribbon)->Arg(40)->Arg(10 << 10);
+
+}  // namespace
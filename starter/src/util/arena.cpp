@@ -1,26 +1,99 @@
 #include "util/arena.h"
 
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <thread>
+
 namespace minilsm {
 
-static const int kBlockSize = 4096;
+static const int kAlign = (sizeof(void*) > 8) ? sizeof(void*) : 8;
+static_assert((kAlign & (kAlign - 1)) == 0,
+              "Pointer size should be a power of 2");
 
-Arena::Arena()
-    : alloc_ptr_(nullptr), alloc_bytes_remaining_(0), memory_usage_(0) {}
+static size_t ShardCount() {
+  const size_t cores =
+      std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  size_t count = 1;
+  while (count < cores) {
+    count *= 2;
+  }
+  return count;
+}
+
+// Huge pages come in powers of two of at least a regular page.
+static size_t ValidHugePageSize(size_t huge_page_size) {
+  if (huge_page_size < Arena::kMinBlockSize ||
+      (huge_page_size & (huge_page_size - 1)) != 0) {
+    return 0;
+  }
+  return huge_page_size;
+}
+
+// The size of the pages reserved for MAP_HUGETLB, or 0 if unknown.
+static size_t SystemHugePageSize() {
+  static const size_t size = [] {
+    size_t result = 0;
+#if defined(__linux__)
+    FILE* f = std::fopen("/proc/meminfo", "re");
+    if (f != nullptr) {
+      char line[128];
+      unsigned long kb;
+      while (std::fgets(line, sizeof(line), f) != nullptr) {
+        if (std::sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+          result = static_cast<size_t>(kb) << 10;
+          break;
+        }
+      }
+      std::fclose(f);
+    }
+#endif
+    return result;
+  }();
+  return size;
+}
+
+static size_t BlockSize(size_t block_size, size_t huge_page_size) {
+  block_size = std::max(block_size, Arena::kMinBlockSize);
+  if (huge_page_size > 0) {
+    block_size = (block_size + huge_page_size - 1) / huge_page_size *
+                 huge_page_size;
+  }
+  return block_size;
+}
+
+Arena::Arena(size_t block_size, size_t huge_page_size)
+    : huge_page_size_(ValidHugePageSize(huge_page_size)),
+      block_size_(BlockSize(block_size, huge_page_size_)),
+      shard_block_size_(std::min<size_t>(128 << 10, block_size_ / 8)),
+      alloc_ptr_(nullptr),
+      alloc_bytes_remaining_(0),
+      memory_usage_(0),
+      shards_(new Shard[ShardCount()]),
+      shard_mask_(ShardCount() - 1) {}
 
 Arena::~Arena() {
   for (size_t i = 0; i < blocks_.size(); i++) {
     delete[] blocks_[i];
   }
+  for (const auto& block : mapped_blocks_) {
+    munmap(block.first, block.second);
+  }
 }
 
 char* Arena::AllocateFallback(size_t bytes) {
-  if (bytes > kBlockSize / 4) {
+  if (bytes > block_size_ / 4) {
     char* result = AllocateNewBlock(bytes);
     return result;
   }
   // We waste the remaining space in the current block.
-  alloc_ptr_ = AllocateNewBlock(kBlockSize);
-  alloc_bytes_remaining_ = kBlockSize;
+  alloc_ptr_ = AllocateNewBlock(block_size_);
+  alloc_bytes_remaining_ = block_size_;
 
   char* result = alloc_ptr_;
   alloc_ptr_ += bytes;
@@ -29,11 +102,8 @@ char* Arena::AllocateFallback(size_t bytes) {
 }
 
 char* Arena::AllocateAligned(size_t bytes) {
-  const int align = (sizeof(void*) > 8) ? sizeof(void*) : 8;
-  static_assert((align & (align - 1)) == 0,
-                "Pointer size should be a power of 2");
-  size_t current_mod = reinterpret_cast<uintptr_t>(alloc_ptr_) & (align - 1);
-  size_t slop = current_mod == 0 ? 0 : align - current_mod;
+  size_t current_mod = reinterpret_cast<uintptr_t>(alloc_ptr_) & (kAlign - 1);
+  size_t slop = current_mod == 0 ? 0 : kAlign - current_mod;
   size_t needed = bytes + slop;
   char* result;
   if (needed < alloc_bytes_remaining_) {
@@ -43,11 +113,137 @@ char* Arena::AllocateAligned(size_t bytes) {
   } else {
     result = AllocateFallback(bytes);  // always return aligned memory
   }
-  assert((reinterpret_cast<uintptr_t>(result) & (align - 1)) == 0);
+  assert((reinterpret_cast<uintptr_t>(result) & (kAlign - 1)) == 0);
   return result;
 }
 
+Arena::Shard* Arena::CurrentShard() {
+#if defined(__linux__)
+  const int cpu = sched_getcpu();
+  if (cpu >= 0) {
+    return &shards_[cpu & shard_mask_];
+  }
+#endif
+  // Without the core, spread threads over the shards.
+  static thread_local const size_t index =
+      std::hash<std::thread::id>()(std::this_thread::get_id());
+  return &shards_[index & shard_mask_];
+}
+
+char* Arena::AllocateFromShard(size_t bytes, bool aligned) {
+  assert(bytes > 0);
+  if (bytes > shard_block_size_ / 4) {
+    std::lock_guard<std::mutex> l(mu_);
+    return aligned ? AllocateAligned(bytes) : Allocate(bytes);
+  }
+
+  Shard* shard = CurrentShard();
+  std::lock_guard<std::mutex> l(shard->mu);
+  size_t unused = shard->allocated_and_unused.load(std::memory_order_relaxed);
+  size_t slop = 0;
+  if (aligned) {
+    const size_t current_mod =
+        reinterpret_cast<uintptr_t>(shard->free_begin) & (kAlign - 1);
+    slop = current_mod == 0 ? 0 : kAlign - current_mod;
+  }
+  if (bytes + slop > unused) {
+    // Refill, wasting what is left.  Shard blocks start aligned.
+    char* refill;
+    {
+      std::lock_guard<std::mutex> main(mu_);
+      refill = AllocateAligned(shard_block_size_);
+    }
+    shard->free_begin = refill;
+    slop = 0;
+    // Published after memory_usage_ grew, for MemoryUsage().
+    shard->allocated_and_unused.fetch_add(shard_block_size_ - unused,
+                                          std::memory_order_release);
+    unused = shard_block_size_;
+  }
+  char* result = shard->free_begin + slop;
+  shard->free_begin += bytes + slop;
+  shard->allocated_and_unused.fetch_sub(bytes + slop,
+                                        std::memory_order_relaxed);
+  return result;
+}
+
+char* Arena::AllocateShared(size_t bytes) {
+  return AllocateFromShard(bytes, false);
+}
+
+char* Arena::AllocateAlignedShared(size_t bytes) {
+  return AllocateFromShard(bytes, true);
+}
+
+size_t Arena::MemoryUsage() const {
+  // Read the shards first: memory they reserved is already part of
+  // memory_usage_ by then.
+  size_t unused = 0;
+  for (size_t i = 0; i <= shard_mask_; i++) {
+    unused += shards_[i].allocated_and_unused.load(std::memory_order_acquire);
+  }
+  return memory_usage_.load(std::memory_order_relaxed) - unused;
+}
+
+char* Arena::MapHugePages(size_t bytes) {
+  assert(bytes % huge_page_size_ == 0);
+#ifdef MAP_HUGETLB
+  // The kernel maps reserved pages of its own size, rounding the length
+  // up, and munmap of bytes would then fail or leave the tail mapped.
+  // So they only serve sizes that are a multiple of it.
+  const size_t system_huge_page_size = SystemHugePageSize();
+  if (system_huge_page_size > 0 &&
+      huge_page_size_ % system_huge_page_size == 0) {
+    void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED) {
+      return reinterpret_cast<char*>(addr);
+    }
+  }
+#endif
+#ifdef MADV_HUGEPAGE
+  // Transparent huge pages only back aligned ranges, so map a page more
+  // than needed and trim both ends to a huge page boundary.
+  const size_t mapped = bytes + huge_page_size_;
+  void* raw = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return nullptr;
+  }
+  char* const begin = reinterpret_cast<char*>(raw);
+  const uintptr_t misalignment =
+      reinterpret_cast<uintptr_t>(begin) % huge_page_size_;
+  char* const result =
+      misalignment == 0 ? begin : begin + (huge_page_size_ - misalignment);
+  if (result > begin) {
+    munmap(begin, result - begin);
+  }
+  char* const end = begin + mapped;
+  if (end > result + bytes) {
+    munmap(result + bytes, end - (result + bytes));
+  }
+  if (madvise(result, bytes, MADV_HUGEPAGE) != 0) {
+    munmap(result, bytes);
+    return nullptr;
+  }
+  return result;
+#else
+  return nullptr;
+#endif
+}
+
 char* Arena::AllocateNewBlock(size_t block_bytes) {
+  if (huge_page_size_ > 0) {
+    const size_t bytes = (block_bytes + huge_page_size_ - 1) /
+                         huge_page_size_ * huge_page_size_;
+    char* result = MapHugePages(bytes);
+    if (result != nullptr) {
+      mapped_blocks_.emplace_back(result, bytes);
+      memory_usage_.fetch_add(bytes + sizeof(char*) + sizeof(size_t),
+                              std::memory_order_relaxed);
+      return result;
+    }
+  }
   char* result = new char[block_bytes];
   blocks_.push_back(result);
   memory_usage_.fetch_add(block_bytes + sizeof(char*),
@@ -4,32 +4,85 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 namespace minilsm {
 
 class Arena {
 public:
-  Arena();
+  static constexpr size_t kMinBlockSize = 4096;
+
+  // Memory is carved out of blocks of block_size bytes; larger blocks
+  // mean fewer heap allocations.  Requests bigger than a quarter of a
+  // block get a block of their own.
+  //
+  // If huge_page_size is positive, blocks are mapped in whole huge pages
+  // of that size, which cuts TLB misses when walking data spread over
+  // many blocks.  block_size is rounded up to a multiple of it.  Uses
+  // reserved huge pages (MAP_HUGETLB) if there are any and the size is
+  // a multiple of theirs, else asks for transparent ones
+  // (MADV_HUGEPAGE), else falls back to the heap.
+  // Ignored unless a power of two of at least kMinBlockSize.
+  explicit Arena(size_t block_size = kMinBlockSize,
+                 size_t huge_page_size = 0);
   Arena(const Arena&) = delete;
   Arena& operator=(const Arena&) = delete;
   ~Arena();
   char* Allocate(size_t bytes);
   char* AllocateAligned(size_t bytes);
 
+  // Thread-safe counterparts of Allocate and AllocateAligned, for
+  // memtables that are written by several threads at once.  Any thread
+  // may call them concurrently with each other, but not concurrently
+  // with the unsynchronized versions above.
+  //
+  // Each core allocates from its own shard, a small chunk of a block,
+  // so threads on different cores rarely contend; only refilling a
+  // shard, or a request too big for one, takes a lock shared by all.
+  char* AllocateShared(size_t bytes);
+  char* AllocateAlignedShared(size_t bytes);
+
   // Returns an estimate of the total memory usage of data allocated
-  // by the arena.
-  size_t MemoryUsage() const {
-    return memory_usage_.load(std::memory_order_relaxed);
-  }
+  // by the arena.  Memory that shards have reserved but not handed out
+  // yet is not counted.  Safe to call at any time.
+  size_t MemoryUsage() const;
+
 private:
+  // Memory reserved by a core, and handed out by AllocateShared.
+  struct alignas(64) Shard {
+    std::mutex mu;
+    char* free_begin = nullptr;
+    // Bytes left at free_begin.
+    std::atomic<size_t> allocated_and_unused{0};
+  };
+
   char* AllocateFallback(size_t bytes);
   char* AllocateNewBlock(size_t block_bytes);
+  // Map bytes, a multiple of huge_page_size_, or return nullptr.
+  char* MapHugePages(size_t bytes);
+  char* AllocateFromShard(size_t bytes, bool aligned);
+  Shard* CurrentShard();
+
+  const size_t huge_page_size_;
+  const size_t block_size_;
+  // Bytes a shard takes from a block at a time.
+  const size_t shard_block_size_;
 
   char* alloc_ptr_;
   size_t alloc_bytes_remaining_;
   std::vector<char*> blocks_;   // allocated memory
+  std::vector<std::pair<char*, size_t>> mapped_blocks_;  // and their sizes
   std::atomic<size_t> memory_usage_;
+
+  // Serializes the *Shared allocation paths that take memory from the
+  // blocks directly.
+  std::mutex mu_;
+  // A power of two of them, at least one per core.
+  std::unique_ptr<Shard[]> shards_;
+  size_t shard_mask_;
 };
 
 inline char* Arena::Allocate(size_t bytes) {
@@ -44,4 +97,3 @@ inline char* Arena::Allocate(size_t bytes) {
 }
 }
 #endif  // MINILSM_UTIL_ARENA_H
-
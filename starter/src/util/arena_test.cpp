@@ -0,0 +1,136 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/arena.h"
+
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "util/random.h"
+
+#include <gtest/gtest.h>
+
+namespace minilsm {
+
+TEST(ArenaTest, Empty) { Arena arena; }
+
+TEST(ArenaTest, Simple) {
+  std::vector<std::pair<size_t, char*>> allocated;
+  Arena arena;
+  const int N = 100000;
+  size_t bytes = 0;
+  Random rnd(301);
+  for (int i = 0; i < N; i++) {
+    size_t s;
+    if (i % (N / 10) == 0) {
+      s = i;
+    } else {
+      s = rnd.OneIn(4000)
+              ? rnd.Uniform(6000)
+              : (rnd.OneIn(10) ? rnd.Uniform(100) : rnd.Uniform(20));
+    }
+    if (s == 0) {
+      // Our arena disallows size 0 allocations.
+      s = 1;
+    }
+    char* r;
+    if (rnd.OneIn(10)) {
+      r = arena.AllocateAligned(s);
+    } else {
+      r = arena.Allocate(s);
+    }
+
+    for (size_t b = 0; b < s; b++) {
+      // Fill the "i"th allocation with a known bit pattern
+      r[b] = i % 256;
+    }
+    bytes += s;
+    allocated.push_back(std::make_pair(s, r));
+    ASSERT_GE(arena.MemoryUsage(), bytes);
+    if (i > N / 10) {
+      ASSERT_LE(arena.MemoryUsage(), bytes * 1.10);
+    }
+  }
+  for (size_t i = 0; i < allocated.size(); i++) {
+    size_t num_bytes = allocated[i].first;
+    const char* p = allocated[i].second;
+    for (size_t b = 0; b < num_bytes; b++) {
+      // Check the "i"th allocation for the known bit pattern
+      ASSERT_EQ(int(p[b]) & 0xff, i % 256);
+    }
+  }
+}
+
+static void HugePagesRoundTrip(size_t huge_page_size) {
+  Arena arena(4096, huge_page_size);
+  std::vector<std::pair<size_t, char*>> allocated;
+  Random rnd(301);
+  size_t bytes = 0;
+  for (int i = 0; i < 50000; i++) {
+    const size_t s = rnd.OneIn(1000) ? 1 + rnd.Uniform(1 << 20)
+                                     : 1 + rnd.Uniform(200);
+    char* r = rnd.OneIn(2) ? arena.AllocateAligned(s) : arena.Allocate(s);
+    std::memset(r, i & 0xff, s);
+    allocated.emplace_back(s, r);
+    bytes += s;
+  }
+  for (size_t i = 0; i < allocated.size(); i++) {
+    for (size_t b = 0; b < allocated[i].first; b++) {
+      ASSERT_EQ(i & 0xff, allocated[i].second[b] & 0xff);
+    }
+  }
+  ASSERT_GE(arena.MemoryUsage(), bytes);
+}
+
+TEST(ArenaTest, HugePages) {
+  // Works whether or not the system has huge pages to give, and with a
+  // size smaller than the system's.
+  for (size_t huge_page_size : {size_t{2} << 20, size_t{64} << 10}) {
+    HugePagesRoundTrip(huge_page_size);
+  }
+}
+
+TEST(ArenaTest, AllocateShared) {
+  // Big blocks, so that most requests come from the shards.
+  Arena arena(1 << 20);
+  const int kThreads = 8;
+  const int kPerThread = 20000;
+  std::vector<std::vector<std::pair<size_t, char*>>> allocated(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&arena, &allocated, t] {
+      Random rnd(301 + t);
+      for (int i = 0; i < kPerThread; i++) {
+        const size_t s = rnd.OneIn(1000) ? 1 + rnd.Uniform(100000)
+                                         : 1 + rnd.Uniform(100);
+        char* r = rnd.OneIn(2) ? arena.AllocateAlignedShared(s)
+                               : arena.AllocateShared(s);
+        for (size_t b = 0; b < s; b++) {
+          r[b] = static_cast<char>(t);
+        }
+        allocated[t].emplace_back(s, r);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  size_t bytes = 0;
+  for (int t = 0; t < kThreads; t++) {
+    for (const auto& allocation : allocated[t]) {
+      for (size_t b = 0; b < allocation.first; b++) {
+        ASSERT_EQ(t, allocation.second[b]);
+      }
+      bytes += allocation.first;
+    }
+  }
+  // Memory reserved by the shards but not handed out does not count.
+  ASSERT_GE(arena.MemoryUsage(), bytes);
+  ASSERT_LE(arena.MemoryUsage(), bytes * 1.25);
+}
+
+}  // namespace minilsm
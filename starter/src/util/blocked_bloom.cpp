@@ -0,0 +1,166 @@
+// A bloom filter whose probes for a key all fall in one 64-byte line of
+// the filter, so a check costs one cache miss rather than one per probe.
+// That is worth a slightly higher false positive rate than a standard
+// bloom filter of the same size.
+//
+// Filter layout:
+//    lines: char[64 * num_lines]
+//    num_probes: uint8
+//
+// A key's hash picks its line, and probe i tests bit (hash * kMultipliers[i])
+// >> 23 of the line, so up to eight probes can be computed and tested at
+// once.  Where the CPU has AVX2, they are.
+
+#include "minilsm/filter_policy.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MINILSM_BLOCKED_BLOOM_AVX2 1
+#include <immintrin.h>
+#endif
+
+#include "minilsm/slice.h"
+#include "util/blocked_bloom_test_helper.h"
+#include "util/hash.h"
+
+namespace minilsm {
+
+namespace {
+
+constexpr size_t kLineBytes = 64;
+constexpr int kMaxProbes = 8;
+
+// Odd, so that each probe uses every bit of the hash.
+constexpr uint32_t kMultipliers[kMaxProbes] = {
+    0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+    0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+
+uint32_t BlockedBloomHash(const Slice& key) {
+  return Hash(key.data(), key.size(), 0xbc9f1d34);
+}
+
+// Scale the hash down to [0, num_lines) without a division.
+size_t LineOffset(uint32_t h, size_t num_lines) {
+  return static_cast<size_t>((uint64_t{h} * num_lines) >> 32) * kLineBytes;
+}
+
+bool LineMayMatchPortable(uint32_t h, const char* line, int num_probes) {
+  for (int i = 0; i < num_probes; i++) {
+    const uint32_t bit = (h * kMultipliers[i]) >> 23;
+    if ((line[bit >> 3] & (1 << (bit & 7))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if MINILSM_BLOCKED_BLOOM_AVX2
+// Same as LineMayMatchPortable, with the probes done in the eight 32-bit
+// lanes of a vector.  Bit b of the line is bit b % 32 of its little
+// endian word b / 32.
+__attribute__((target("avx2"))) bool LineMayMatchAVX2(uint32_t h,
+                                                      const char* line,
+                                                      int num_probes) {
+  const __m256i multipliers = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(kMultipliers));
+  const __m256i bits =
+      _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(h), multipliers),
+                        23);
+  const __m256i words = _mm256_srli_epi32(bits, 5);
+  // Fetch word words[i] of the line into lane i, from one half of the
+  // line or the other.
+  const __m256i lo =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line));
+  const __m256i hi =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + 32));
+  const __m256i in_hi = _mm256_cmpgt_epi32(words, _mm256_set1_epi32(7));
+  const __m256i probed =
+      _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(lo, words),
+                         _mm256_permutevar8x32_epi32(hi, words), in_hi);
+  __m256i masks = _mm256_sllv_epi32(
+      _mm256_set1_epi32(1), _mm256_and_si256(bits, _mm256_set1_epi32(31)));
+  // Lanes past num_probes test nothing.
+  masks = _mm256_and_si256(
+      masks, _mm256_cmpgt_epi32(_mm256_set1_epi32(num_probes),
+                                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+  // Whether every bit of masks is set in probed.
+  return _mm256_testc_si256(probed, masks);
+}
+#endif
+
+using LineMayMatchFunction = bool (*)(uint32_t, const char*, int);
+
+LineMayMatchFunction ChooseLineMayMatch() {
+#if MINILSM_BLOCKED_BLOOM_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return LineMayMatchAVX2;
+  }
+#endif
+  return LineMayMatchPortable;
+}
+
+class BlockedBloomFilterPolicy : public FilterPolicy {
+ public:
+  BlockedBloomFilterPolicy(int bits_per_key,
+                           LineMayMatchFunction line_may_match)
+      : bits_per_key_(bits_per_key), line_may_match_(line_may_match) {
+    // We intentionally round down to reduce probing cost a little bit
+    num_probes_ = static_cast<int>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
+    if (num_probes_ < 1) num_probes_ = 1;
+    if (num_probes_ > kMaxProbes) num_probes_ = kMaxProbes;
+  }
+
+  const char* Name() const override { return "minilsm.BlockedBloomFilter"; }
+
+  void CreateFilter(const Slice* keys, int n, std::string* dst) const override {
+    const size_t bits = static_cast<size_t>(n) * bits_per_key_;
+    const size_t num_lines = bits / (kLineBytes * 8) + 1;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + num_lines * kLineBytes, 0);
+    dst->push_back(static_cast<char>(num_probes_));
+    char* array = &(*dst)[init_size];
+    for (int i = 0; i < n; i++) {
+      const uint32_t h = BlockedBloomHash(keys[i]);
+      char* line = array + LineOffset(h, num_lines);
+      for (int j = 0; j < num_probes_; j++) {
+        const uint32_t bit = (h * kMultipliers[j]) >> 23;
+        line[bit >> 3] |= (1 << (bit & 7));
+      }
+    }
+  }
+
+  bool KeyMayMatch(const Slice& key, const Slice& filter) const override {
+    const size_t len = filter.size();
+    if (len == 0) {
+      return false;  // Filter of no keys
+    }
+    if (len < kLineBytes + 1 || (len - 1) % kLineBytes != 0) {
+      return true;  // Errors are treated as potential matches
+    }
+    const int num_probes = static_cast<uint8_t>(filter[len - 1]);
+    if (num_probes < 1 || num_probes > kMaxProbes) {
+      return true;
+    }
+    const uint32_t h = BlockedBloomHash(key);
+    const char* line = filter.data() + LineOffset(h, (len - 1) / kLineBytes);
+    return line_may_match_(h, line, num_probes);
+  }
+
+ private:
+  const size_t bits_per_key_;
+  int num_probes_;
+  const LineMayMatchFunction line_may_match_;
+};
+
+}  // namespace
+
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key) {
+  return new BlockedBloomFilterPolicy(bits_per_key, ChooseLineMayMatch());
+}
+
+const FilterPolicy* BlockedBloomTestHelper::NewPortablePolicy(
+    int bits_per_key) {
+  return new BlockedBloomFilterPolicy(bits_per_key, LineMayMatchPortable);
+}
+
+}  // namespace minilsm
@@ -0,0 +1,21 @@
+#ifndef MINILSM_UTIL_BLOCKED_BLOOM_TEST_HELPER_H_
+#define MINILSM_UTIL_BLOCKED_BLOOM_TEST_HELPER_H_
+
+namespace minilsm {
+
+class BlockedBloomTest;
+class FilterPolicy;
+
+// A helper for the blocked bloom filter to facilitate testing.
+class BlockedBloomTestHelper {
+ private:
+  friend class BlockedBloomTest;
+
+  // Like NewBlockedBloomFilterPolicy(), but probes without vector
+  // instructions even where the CPU has them.
+  static const FilterPolicy* NewPortablePolicy(int bits_per_key);
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_UTIL_BLOCKED_BLOOM_TEST_HELPER_H_
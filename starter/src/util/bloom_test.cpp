@@ -0,0 +1,274 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "minilsm/filter_policy.h"
+#include "minilsm/slice.h"
+#include "util/blocked_bloom_test_helper.h"
+#include "util/coding.h"
+
+#include <gtest/gtest.h>
+
+namespace minilsm {
+
+static const int kVerbose = 1;
+
+static Slice Key(int i, char* buffer) {
+  EncodeFixed32(buffer, i);
+  return Slice(buffer, sizeof(uint32_t));
+}
+
+class BloomTest : public testing::Test {
+ public:
+  explicit BloomTest(const FilterPolicy* policy = NewBloomFilterPolicy(10))
+      : policy_(policy) {}
+
+  ~BloomTest() override { delete policy_; }
+
+  void Reset() {
+    keys_.clear();
+    filter_.clear();
+  }
+
+  void Add(const Slice& s) { keys_.push_back(s.ToString()); }
+
+  void Build() {
+    std::vector<Slice> key_slices;
+    for (size_t i = 0; i < keys_.size(); i++) {
+      key_slices.push_back(Slice(keys_[i]));
+    }
+    filter_.clear();
+    policy_->CreateFilter(&key_slices[0], static_cast<int>(key_slices.size()),
+                          &filter_);
+    keys_.clear();
+  }
+
+  size_t FilterSize() const { return filter_.size(); }
+
+  bool Matches(const Slice& s) {
+    if (!keys_.empty()) {
+      Build();
+    }
+    return policy_->KeyMayMatch(s, filter_);
+  }
+
+  double FalsePositiveRate() {
+    char buffer[sizeof(int)];
+    int result = 0;
+    for (int i = 0; i < 10000; i++) {
+      if (Matches(Key(i + 1000000000, buffer))) {
+        result++;
+      }
+    }
+    return result / 10000.0;
+  }
+
+ private:
+  const FilterPolicy* policy_;
+  std::string filter_;
+  std::vector<std::string> keys_;
+};
+
+TEST_F(BloomTest, EmptyFilter) {
+  ASSERT_TRUE(!Matches("hello"));
+  ASSERT_TRUE(!Matches("world"));
+}
+
+TEST_F(BloomTest, Small) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+  ASSERT_TRUE(!Matches("foo"));
+}
+
+static int NextLength(int length) {
+  if (length < 10) {
+    length += 1;
+  } else if (length < 100) {
+    length += 10;
+  } else if (length < 1000) {
+    length += 100;
+  } else {
+    length += 1000;
+  }
+  return length;
+}
+
+TEST_F(BloomTest, VaryingLengths) {
+  char buffer[sizeof(int)];
+
+  // Count number of filters that significantly exceed the false positive rate
+  int mediocre_filters = 0;
+  int good_filters = 0;
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 10 / 8) + 40))
+        << length;
+
+    // All added keys must match
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    // Check false positive rate
+    double rate = FalsePositiveRate();
+    if (kVerbose >= 2) {
+      std::fprintf(stderr,
+                   "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+                   rate * 100.0, length, static_cast<int>(FilterSize()));
+    }
+    ASSERT_LE(rate, 0.02);  // Must not be over 2%
+    if (rate > 0.0125) {
+      mediocre_filters++;  // Allowed, but not too often
+    } else {
+      good_filters++;
+    }
+  }
+  ASSERT_LE(mediocre_filters, good_filters / 5);
+}
+
+class BlockedBloomTest : public BloomTest {
+ public:
+  BlockedBloomTest() : BloomTest(NewBlockedBloomFilterPolicy(10)) {}
+
+  static const FilterPolicy* NewPortablePolicy(int bits_per_key) {
+    return BlockedBloomTestHelper::NewPortablePolicy(bits_per_key);
+  }
+};
+
+TEST_F(BlockedBloomTest, EmptyFilter) {
+  ASSERT_TRUE(!Matches("hello"));
+  ASSERT_TRUE(!Matches("world"));
+}
+
+TEST_F(BlockedBloomTest, Small) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+  ASSERT_TRUE(!Matches("foo"));
+}
+
+TEST_F(BlockedBloomTest, VaryingLengths) {
+  char buffer[sizeof(int)];
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    // Whole cache lines, plus the number of probes.
+    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 10 / 8) + 65))
+        << length;
+    ASSERT_EQ(1, FilterSize() % 64) << length;
+
+    // All added keys must match
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    ASSERT_LE(FalsePositiveRate(), 0.02) << length;  // Must not be over 2%
+  }
+}
+
+TEST_F(BlockedBloomTest, PortableProbesAgree) {
+  // The policy in use may probe with vector instructions; the portable
+  // probes must give the same answers on the same filters.
+  char buffer[sizeof(int)];
+  for (int bits_per_key = 1; bits_per_key <= 12; bits_per_key++) {
+    const FilterPolicy* policy = NewBlockedBloomFilterPolicy(bits_per_key);
+    const FilterPolicy* portable = NewPortablePolicy(bits_per_key);
+    for (int length = 1; length <= 10000; length = NextLength(length)) {
+      std::vector<std::string> keys;
+      for (int i = 0; i < length; i++) {
+        keys.push_back(Key(i, buffer).ToString());
+      }
+      std::vector<Slice> key_slices(keys.begin(), keys.end());
+      std::string filter;
+      policy->CreateFilter(key_slices.data(), length, &filter);
+      for (int i = 0; i < 2 * length + 100; i++) {
+        const Slice key = Key(i, buffer);
+        ASSERT_EQ(policy->KeyMayMatch(key, filter),
+                  portable->KeyMayMatch(key, filter))
+            << bits_per_key << " bits per key, length " << length
+            << ", key " << i;
+      }
+    }
+    delete policy;
+    delete portable;
+  }
+}
+
+class RibbonTest : public BloomTest {
+ public:
+  RibbonTest() : BloomTest(NewRibbonFilterPolicy(10)) {}
+};
+
+TEST_F(RibbonTest, EmptyFilter) {
+  ASSERT_TRUE(!Matches("hello"));
+  ASSERT_TRUE(!Matches("world"));
+}
+
+TEST_F(RibbonTest, Small) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+  ASSERT_TRUE(!Matches("foo"));
+}
+
+TEST_F(RibbonTest, Duplicates) {
+  for (int i = 0; i < 100; i++) {
+    Add("hello");
+    Add("world");
+  }
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+}
+
+TEST_F(RibbonTest, VaryingLengths) {
+  char buffer[sizeof(int)];
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    // At most 7.5 bits per key, against the bloom filter's 10, once the
+    // few slots of slack stop mattering.
+    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 15 / 16) + 12))
+        << length;
+
+    // All added keys must match
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    // No worse than the bloom filter, which is around 1%.
+    ASSERT_LE(FalsePositiveRate(), 0.0125) << length;
+  }
+}
+
+}  // namespace minilsm
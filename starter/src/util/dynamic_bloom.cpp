@@ -0,0 +1,35 @@
+#include "util/dynamic_bloom.h"
+
+#include <cassert>
+#include <new>
+
+#include "util/arena.h"
+
+namespace minilsm {
+
+namespace {
+constexpr size_t kCacheLineSize = 64;
+}  // namespace
+
+DynamicBloom::DynamicBloom(Arena* arena, uint32_t total_bits, int num_probes)
+    : num_probes_(num_probes) {
+  assert(num_probes > 0);
+  num_lines_ = (total_bits + kCacheLineSize * 8 - 1) / (kCacheLineSize * 8);
+  if (num_lines_ == 0) {
+    num_lines_ = 1;
+  }
+  // Over-allocate to start the first line on a cache line boundary.
+  const size_t bytes = num_lines_ * kCacheLineSize;
+  char* raw = arena->AllocateAligned(bytes + kCacheLineSize - 1);
+  const uintptr_t misalignment =
+      reinterpret_cast<uintptr_t>(raw) & (kCacheLineSize - 1);
+  if (misalignment != 0) {
+    raw += kCacheLineSize - misalignment;
+  }
+  data_ = reinterpret_cast<std::atomic<uint64_t>*>(raw);
+  for (size_t i = 0; i < num_lines_ * 8; i++) {
+    new (&data_[i]) std::atomic<uint64_t>(0);
+  }
+}
+
+}  // namespace minilsm
@@ -0,0 +1,95 @@
+#ifndef MINILSM_UTIL_DYNAMIC_BLOOM_H_
+#define MINILSM_UTIL_DYNAMIC_BLOOM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "minilsm/slice.h"
+#include "util/hash.h"
+
+namespace minilsm {
+
+class Arena;
+
+// A bloom filter that is filled in while it is being read, for
+// memtables.  All probes of a key fall in one 64-byte cache line, so a
+// lookup costs a single cache miss.  The bits live in an arena.
+//
+// Add requires external synchronization, like a memtable insert;
+// AddConcurrently may be called from several threads at once.
+// MayContain may run concurrently with either.  A key added before a
+// MayContain call happens is always found.
+class DynamicBloom {
+ public:
+  // Allocate total_bits, rounded up to whole cache lines, from arena.
+  DynamicBloom(Arena* arena, uint32_t total_bits, int num_probes = 6);
+
+  DynamicBloom(const DynamicBloom&) = delete;
+  DynamicBloom& operator=(const DynamicBloom&) = delete;
+
+  void Add(const Slice& key) {
+    AddHash(BloomHash(key), [](std::atomic<uint64_t>* word, uint64_t mask) {
+      word->store(word->load(std::memory_order_relaxed) | mask,
+                  std::memory_order_relaxed);
+    });
+  }
+
+  void AddConcurrently(const Slice& key) {
+    AddHash(BloomHash(key), [](std::atomic<uint64_t>* word, uint64_t mask) {
+      // Skip the write if the bit is already set, which is common and
+      // keeps the line shared between cores.
+      if ((word->load(std::memory_order_relaxed) & mask) != mask) {
+        word->fetch_or(mask, std::memory_order_relaxed);
+      }
+    });
+  }
+
+  // False if key was certainly never added.
+  bool MayContain(const Slice& key) const {
+    uint32_t h = BloomHash(key);
+    const std::atomic<uint64_t>* line = Line(h);
+    const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
+    for (int i = 0; i < num_probes_; i++) {
+      const uint32_t bit = h & 511;
+      if ((line[bit >> 6].load(std::memory_order_relaxed) &
+           (uint64_t{1} << (bit & 63))) == 0) {
+        return false;
+      }
+      h += delta;
+    }
+    return true;
+  }
+
+ private:
+  static uint32_t BloomHash(const Slice& key) {
+    return Hash(key.data(), key.size(), 0xbc9f1d34);
+  }
+
+  // The eight words of the cache line of hash h.
+  std::atomic<uint64_t>* Line(uint32_t h) const {
+    // Scale the hash down to [0, num_lines_) without a division.
+    const uint32_t line = static_cast<uint32_t>(
+        (uint64_t{h} * num_lines_) >> 32);
+    return &data_[line * 8];
+  }
+
+  template <typename SetBits>
+  void AddHash(uint32_t h, const SetBits& set_bits) {
+    std::atomic<uint64_t>* line = Line(h);
+    const uint32_t delta = (h >> 17) | (h << 15);
+    for (int i = 0; i < num_probes_; i++) {
+      const uint32_t bit = h & 511;
+      set_bits(&line[bit >> 6], uint64_t{1} << (bit & 63));
+      h += delta;
+    }
+  }
+
+  uint32_t num_lines_;
+  const int num_probes_;
+  std::atomic<uint64_t>* data_;
+};
+
+}  // namespace minilsm
+
+#endif  // MINILSM_UTIL_DYNAMIC_BLOOM_H_
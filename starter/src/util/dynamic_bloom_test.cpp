@@ -0,0 +1,72 @@
+#include "util/dynamic_bloom.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/arena.h"
+#include "util/coding.h"
+
+#include <gtest/gtest.h>
+
+namespace minilsm {
+
+static Slice Key(int i, char* buffer) {
+  EncodeFixed32(buffer, i);
+  return Slice(buffer, sizeof(uint32_t));
+}
+
+TEST(DynamicBloomTest, EmptyFilter) {
+  Arena arena;
+  DynamicBloom bloom(&arena, 100);
+  ASSERT_FALSE(bloom.MayContain("hello"));
+  ASSERT_FALSE(bloom.MayContain("world"));
+}
+
+TEST(DynamicBloomTest, VaryingLengths) {
+  char buffer[sizeof(uint32_t)];
+  for (int length = 1; length <= 10000; length *= 10) {
+    Arena arena;
+    DynamicBloom bloom(&arena, length * 10);
+    for (int i = 0; i < length; i++) {
+      bloom.Add(Key(i, buffer));
+    }
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(bloom.MayContain(Key(i, buffer))) << length << " " << i;
+    }
+
+    // At 10 bits per key the false positive rate is about 1%.
+    int false_positives = 0;
+    for (int i = 0; i < 10000; i++) {
+      if (bloom.MayContain(Key(i + 1000000000, buffer))) {
+        false_positives++;
+      }
+    }
+    ASSERT_LE(false_positives, 300) << length;
+  }
+}
+
+TEST(DynamicBloomTest, AddConcurrently) {
+  const int kThreads = 4;
+  const int kKeysPerThread = 10000;
+  Arena arena;
+  DynamicBloom bloom(&arena, kThreads * kKeysPerThread * 10);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&bloom, t] {
+      char buffer[sizeof(uint32_t)];
+      for (int i = t; i < kThreads * kKeysPerThread; i += kThreads) {
+        bloom.AddConcurrently(Key(i, buffer));
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  char buffer[sizeof(uint32_t)];
+  for (int i = 0; i < kThreads * kKeysPerThread; i++) {
+    ASSERT_TRUE(bloom.MayContain(Key(i, buffer))) << i;
+  }
+}
+
+}  // namespace minilsm
@@ -1,8 +1,70 @@
 #include "minilsm/env.h"
 
+#include "minilsm/slice.h"
+
 namespace minilsm {
 // <C++ Primer> zh P552 virtual destructor
 Env::~Env() = default;
 
+SequentialFile::~SequentialFile() = default;
+
 RandomAccessFile::~RandomAccessFile() = default;
-}  // namespace minilsm
\ No newline at end of file
+
+WritableFile::~WritableFile() = default;
+
+Status WritableFile::Appendv(const Slice* data, size_t n) {
+  Status s;
+  for (size_t i = 0; s.ok() && i < n; i++) {
+    s = Append(data[i]);
+  }
+  return s;
+}
+
+EnvWrapper::~EnvWrapper() = default;
+
+Status WriteStringToFileSync(Env* env, const Slice& data,
+                             const std::string& fname) {
+  WritableFile* file;
+  Status s = env->NewWritableFile(fname, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  s = file->Append(data);
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;  // Will auto-close if we did not close above
+  if (!s.ok()) {
+    env->DeleteFile(fname);
+  }
+  return s;
+}
+
+Status ReadFileToString(Env* env, const std::string& fname, std::string* data) {
+  data->clear();
+  SequentialFile* file;
+  Status s = env->NewSequentialFile(fname, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  static const int kBufferSize = 8192;
+  char* space = new char[kBufferSize];
+  while (true) {
+    Slice fragment;
+    s = file->Read(kBufferSize, &fragment, space);
+    if (!s.ok()) {
+      break;
+    }
+    data->append(fragment.data(), fragment.size());
+    if (fragment.empty()) {
+      break;
+    }
+  }
+  delete[] space;
+  delete file;
+  return s;
+}
+}  // namespace minilsm
@@ -6,10 +6,13 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -56,6 +59,16 @@ Status PosixError(const std::string& context, int error_number) {
   }
 }
 
+// Size of the in-memory buffer of PosixWritableFile.
+constexpr const size_t kWritableFileBufferSize = 65536;
+
+// Appendv() copies into the write buffer below this many bytes and
+// hands larger pieces to writev() in place.
+constexpr const size_t kWritableFileGatherThreshold = 4096;
+
+// Maximum number of pieces passed to a single writev() call.
+constexpr const int kMaxIov = 64;
+
 // Helper class to limit resource usage to avoid exhaustion.
 // Currently used to limit read-only file descriptors and mmap file usage
 // so that we do not run out of file descriptors or virtual memory, or run into
@@ -85,6 +98,45 @@ class Limiter {
   // it can be operated on safely using std::memory_order_relaxed.
   std::atomic<int> acquires_allowed_;
 };
+// Implements sequential read access in a file using read().
+//
+// Instances of this class are thread-friendly but not thread-safe, as required
+// by the SequentialFile API.
+class PosixSequentialFile final : public SequentialFile {
+ public:
+  PosixSequentialFile(std::string filename, int fd)
+      : fd_(fd), filename_(std::move(filename)) {}
+  ~PosixSequentialFile() override { ::close(fd_); }
+
+  Status Read(size_t n, Slice* result, char* scratch) override {
+    Status status;
+    while (true) {
+      ::ssize_t read_size = ::read(fd_, scratch, n);
+      if (read_size < 0) {  // Read error.
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        status = PosixError(filename_, errno);
+        break;
+      }
+      *result = Slice(scratch, read_size);
+      break;
+    }
+    return status;
+  }
+
+  Status Skip(uint64_t n) override {
+    if (::lseek(fd_, n, SEEK_CUR) == static_cast<off_t>(-1)) {
+      return PosixError(filename_, errno);
+    }
+    return Status::OK();
+  }
+
+ private:
+  const int fd_;
+  const std::string filename_;
+};
+
 // Implements random read access in a file using pread().
 //
 // Instances of this class are thread-safe, as required by the RandomAccessFile
@@ -185,6 +237,182 @@ class PosixMmapReadableFile final : public RandomAccessFile {
   const std::string filename_;
 };
 
+// Appends go to a user-space buffer first so that small log records do
+// not cost one write(2) each. Flush() hands the buffer to the kernel and
+// Sync() additionally makes it durable.
+class PosixWritableFile final : public WritableFile {
+ public:
+  PosixWritableFile(std::string filename, int fd)
+      : pos_(0), fd_(fd), filename_(std::move(filename)) {}
+
+  ~PosixWritableFile() override {
+    if (fd_ >= 0) {
+      // Ignoring any potential errors
+      Close();
+    }
+  }
+
+  Status Append(const Slice& data) override {
+    size_t write_size = data.size();
+    const char* write_data = data.data();
+
+    // Fit as much as possible into buffer.
+    size_t copy_size = std::min(write_size, kWritableFileBufferSize - pos_);
+    std::memcpy(buf_ + pos_, write_data, copy_size);
+    write_data += copy_size;
+    write_size -= copy_size;
+    pos_ += copy_size;
+    if (write_size == 0) {
+      return Status::OK();
+    }
+
+    // Can't fit in buffer, so need to do at least one write.
+    Status status = FlushBuffer();
+    if (!status.ok()) {
+      return status;
+    }
+
+    // Small writes go to buffer, large writes are written directly.
+    if (write_size < kWritableFileBufferSize) {
+      std::memcpy(buf_, write_data, write_size);
+      pos_ = write_size;
+      return Status::OK();
+    }
+    return WriteUnbuffered(write_data, write_size);
+  }
+
+  Status Appendv(const Slice* data, size_t n) override {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+      total += data[i].size();
+    }
+    if (total < kWritableFileGatherThreshold &&
+        total <= kWritableFileBufferSize - pos_) {
+      for (size_t i = 0; i < n; i++) {
+        std::memcpy(buf_ + pos_, data[i].data(), data[i].size());
+        pos_ += data[i].size();
+      }
+      return Status::OK();
+    }
+
+    // Write out whatever is buffered together with the pieces.
+    struct iovec iov[kMaxIov];
+    int iovcnt = 0;
+    Status status;
+    if (pos_ > 0) {
+      iov[iovcnt].iov_base = buf_;
+      iov[iovcnt].iov_len = pos_;
+      iovcnt++;
+    }
+    for (size_t i = 0; status.ok() && i < n; i++) {
+      if (data[i].empty()) {
+        continue;
+      }
+      iov[iovcnt].iov_base = const_cast<char*>(data[i].data());
+      iov[iovcnt].iov_len = data[i].size();
+      iovcnt++;
+      if (iovcnt == kMaxIov) {
+        status = WriteUnbufferedv(iov, iovcnt);
+        iovcnt = 0;
+      }
+    }
+    if (status.ok() && iovcnt > 0) {
+      status = WriteUnbufferedv(iov, iovcnt);
+    }
+    pos_ = 0;
+    return status;
+  }
+
+  Status Close() override {
+    Status status = FlushBuffer();
+    const int close_result = ::close(fd_);
+    if (close_result < 0 && status.ok()) {
+      status = PosixError(filename_, errno);
+    }
+    fd_ = -1;
+    return status;
+  }
+
+  Status Flush() override { return FlushBuffer(); }
+
+  Status Sync() override {
+    Status status = FlushBuffer();
+    if (!status.ok()) {
+      return status;
+    }
+    return SyncFd(fd_, filename_);
+  }
+
+ private:
+  Status FlushBuffer() {
+    Status status = WriteUnbuffered(buf_, pos_);
+    pos_ = 0;
+    return status;
+  }
+
+  Status WriteUnbuffered(const char* data, size_t size) {
+    while (size > 0) {
+      ssize_t write_result = ::write(fd_, data, size);
+      if (write_result < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        return PosixError(filename_, errno);
+      }
+      data += write_result;
+      size -= write_result;
+    }
+    return Status::OK();
+  }
+
+  // Consumes iov.
+  Status WriteUnbufferedv(struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+      ssize_t write_result = ::writev(fd_, iov, iovcnt);
+      if (write_result < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        return PosixError(filename_, errno);
+      }
+      // Skip what was written, which may end inside a piece.
+      size_t written = static_cast<size_t>(write_result);
+      while (iovcnt > 0 && written >= iov->iov_len) {
+        written -= iov->iov_len;
+        iov++;
+        iovcnt--;
+      }
+      if (iovcnt > 0) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+        iov->iov_len -= written;
+      }
+    }
+    return Status::OK();
+  }
+
+  // Ensures that all the caches associated with the given file descriptor's
+  // data are flushed all the way to durable media.
+  static Status SyncFd(int fd, const std::string& fd_path) {
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    // fdatasync skips the inode metadata that the log does not depend on.
+    if (::fdatasync(fd) == 0) {
+      return Status::OK();
+    }
+#else
+    if (::fsync(fd) == 0) {
+      return Status::OK();
+    }
+#endif
+    return PosixError(fd_path, errno);
+  }
+
+  // buf_[0, pos_ - 1] contains data to be written to fd_.
+  char buf_[kWritableFileBufferSize];
+  size_t pos_;
+  int fd_;
+  const std::string filename_;
+};
+
 class PosixEnv : public Env {
  public:
   PosixEnv();
@@ -195,6 +423,17 @@ class PosixEnv : public Env {
     std::abort();
   }
 
+  Status NewSequentialFile(const std::string& filename,
+                           SequentialFile** result) override {
+    int fd = ::open(filename.c_str(), O_RDONLY | kOpenBaseFlags);
+    if (fd < 0) {
+      *result = nullptr;
+      return PosixError(filename, errno);
+    }
+    *result = new PosixSequentialFile(filename, fd);
+    return Status::OK();
+  }
+
   Status NewRandomAccessFile(const std::string& filename,
                              RandomAccessFile** result) override {
     *result = nullptr;
@@ -227,6 +466,22 @@ class PosixEnv : public Env {
     return status;
   }
 
+  Status NewWritableFile(const std::string& filename,
+                         WritableFile** result) override {
+    int fd = ::open(filename.c_str(),
+                    O_TRUNC | O_WRONLY | O_CREAT | kOpenBaseFlags, 0644);
+    if (fd < 0) {
+      *result = nullptr;
+      return PosixError(filename, errno);
+    }
+    *result = new PosixWritableFile(filename, fd);
+    return Status::OK();
+  }
+
+  bool FileExists(const std::string& filename) override {
+    return ::access(filename.c_str(), F_OK) == 0;
+  }
+
   Status GetChildren(const std::string& directory_path,
                      std::vector<std::string>* result) override {
     result->clear();
@@ -250,6 +505,13 @@ class PosixEnv : public Env {
     return Status::OK();
   }
   
+  Status CreateDir(const std::string& dirname) override {
+    if (::mkdir(dirname.c_str(), 0755) != 0) {
+      return PosixError(dirname, errno);
+    }
+    return Status::OK();
+  }
+
   Status GetFileSize(const std::string& filename, uint64_t* size) override {
     struct ::stat file_stat;
     if (::stat(filename.c_str(), &file_stat) != 0) {
@@ -259,10 +521,55 @@ class PosixEnv : public Env {
     *size = file_stat.st_size;
     return Status::OK();
   }
+
+  Status RenameFile(const std::string& from, const std::string& to) override {
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+      return PosixError(from, errno);
+    }
+    return Status::OK();
+  }
+
+  void Schedule(void (*background_work_function)(void* background_work_arg),
+                void* background_work_arg) override;
+
+  uint64_t NowMicros() override {
+    static constexpr uint64_t kUsecondsPerSecond = 1000000;
+    struct ::timeval tv;
+    ::gettimeofday(&tv, nullptr);
+    return static_cast<uint64_t>(tv.tv_sec) * kUsecondsPerSecond + tv.tv_usec;
+  }
+
+  void SleepForMicroseconds(int micros) override {
+    std::this_thread::sleep_for(std::chrono::microseconds(micros));
+  }
+
  private:
+  void BackgroundThreadMain();
+
+  static void BackgroundThreadEntryPoint(PosixEnv* env) {
+    env->BackgroundThreadMain();
+  }
+
+  // Stores the work item data in a Schedule() call.
+  //
+  // Instances are constructed on the thread calling Schedule() and used on the
+  // background thread.
+  //
+  // This structure is thread-safe because it is immutable.
+  struct BackgroundWorkItem {
+    explicit BackgroundWorkItem(void (*function)(void* arg), void* arg)
+        : function(function), arg(arg) {}
+
+    void (*const function)(void*);
+    void* const arg;
+  };
+
   port::Mutex background_work_mutex_;
-  port::CondVar background_work_cv_;
-  bool started_background_thread_;
+  port::CondVar background_work_cv_;  // Guarded by background_work_mutex_
+  bool started_background_thread_;    // Guarded by background_work_mutex_
+
+  // Guarded by background_work_mutex_
+  std::queue<BackgroundWorkItem> background_work_queue_;
 
   Limiter mmap_limiter_;  // Thread-safe
   Limiter fd_limiter_;    // Thread-safe
@@ -296,6 +603,46 @@ PosixEnv::PosixEnv()
       mmap_limiter_(MaxMmaps()),
       fd_limiter_(MaxOpenFiles()) {}
 
+void PosixEnv::Schedule(
+    void (*background_work_function)(void* background_work_arg),
+    void* background_work_arg) {
+  background_work_mutex_.Lock();
+
+  // Start the background thread, if we haven't done so already.
+  if (!started_background_thread_) {
+    started_background_thread_ = true;
+    std::thread background_thread(PosixEnv::BackgroundThreadEntryPoint, this);
+    background_thread.detach();
+  }
+
+  // If the queue is empty, the background thread may be waiting for work.
+  if (background_work_queue_.empty()) {
+    background_work_cv_.Signal();
+  }
+
+  background_work_queue_.emplace(background_work_function, background_work_arg);
+  background_work_mutex_.Unlock();
+}
+
+void PosixEnv::BackgroundThreadMain() {
+  while (true) {
+    background_work_mutex_.Lock();
+
+    // Wait until there is work to be done.
+    while (background_work_queue_.empty()) {
+      background_work_cv_.Wait();
+    }
+
+    assert(!background_work_queue_.empty());
+    auto background_work_function = background_work_queue_.front().function;
+    void* background_work_arg = background_work_queue_.front().arg;
+    background_work_queue_.pop();
+
+    background_work_mutex_.Unlock();
+    background_work_function(background_work_arg);
+  }
+}
+
 namespace {
 
 // Wraps an Env instance whose destructor is never created.
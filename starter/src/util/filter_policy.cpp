@@ -0,0 +1,11 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "minilsm/filter_policy.h"
+
+namespace minilsm {
+
+FilterPolicy::~FilterPolicy() {}
+
+}  // namespace minilsm
@@ -16,6 +16,9 @@ namespace minilsm {
 
 class Slice;
 
+// Append a human-readable printout of "num" to *str
+void AppendNumberTo(std::string* str, uint64_t num);
+
 // Append a human-readable printout of "value" to *str.
 // Escapes any non-printable characters found in "value".
 void AppendEscapedStringTo(std::string* str, const Slice& value);
@@ -24,6 +27,15 @@ void AppendEscapedStringTo(std::string* str, const Slice& value);
 // Escapes any non-printable characters found in "value".
 std::string EscapeString(const Slice& value);
 
+// Return a human-readable printout of "num"
+std::string NumberToString(uint64_t num);
+
+// Parse a human-readable number from "*in" into *value.  On success,
+// advances "*in" past the consumed number and sets "*val" to the
+// numeric value.  Otherwise, returns false and leaves *in in an
+// unspecified state.
+bool ConsumeDecimalNumber(Slice* in, uint64_t* val);
+
 
 }  // namespace minilsm
 
@@ -5,9 +5,20 @@
 #include "minilsm/options.h"
 
 #include "minilsm/comparator.h"
+#include "minilsm/env.h"
+#include "minilsm/memtablerep.h"
+#include "util/no_destructor.h"
 
 namespace minilsm {
 
-Options::Options() : comparator(BytewiseComparator()) {}
+static MemTableRepFactory* DefaultMemTableFactory() {
+  static NoDestructor<SkipListFactory> singleton;
+  return singleton.get();
+}
+
+Options::Options()
+    : comparator(BytewiseComparator()),
+      env(Env::Default()),
+      memtable_factory(DefaultMemTableFactory()) {}
 
 }  // namespace minilsm
@@ -0,0 +1,40 @@
+#include "minilsm/slice_transform.h"
+
+#include <cassert>
+#include <string>
+
+namespace minilsm {
+
+SliceTransform::~SliceTransform() = default;
+
+namespace {
+
+class FixedPrefixTransform : public SliceTransform {
+ public:
+  explicit FixedPrefixTransform(size_t prefix_len)
+      : prefix_len_(prefix_len),
+        name_("minilsm.FixedPrefix." + std::to_string(prefix_len)) {}
+
+  const char* Name() const override { return name_.c_str(); }
+
+  Slice Transform(const Slice& key) const override {
+    assert(InDomain(key));
+    return Slice(key.data(), prefix_len_);
+  }
+
+  bool InDomain(const Slice& key) const override {
+    return key.size() >= prefix_len_;
+  }
+
+ private:
+  const size_t prefix_len_;
+  const std::string name_;
+};
+
+}  // namespace
+
+const SliceTransform* NewFixedPrefixTransform(size_t prefix_len) {
+  return new FixedPrefixTransform(prefix_len);
+}
+
+}  // namespace minilsm